@@ -0,0 +1,102 @@
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#ifndef CACHE_H
+#define CACHE_H
+
+namespace cache {
+
+// LRUByteCache keeps shared values keyed by string within a budget of bytes, as reported by each value's get_size().
+// When the budget is exceeded, the least recently used values are dropped. Values are shared, so an evicted value
+// stays valid for as long as someone still holds it. Caches built on this only say how to make a key and a value
+template <typename T>
+class LRUByteCache {
+public:
+    LRUByteCache(const size_t max_bytes) noexcept : max_bytes{max_bytes} {};
+    LRUByteCache(const LRUByteCache&) = delete;
+    LRUByteCache& operator=(const LRUByteCache&) = delete;
+    std::shared_ptr<const T> find(const std::string& key);
+    void insert(const std::string& key, std::shared_ptr<const T> value);
+    void set_max_bytes(const size_t bytes) noexcept;
+    size_t get_max_bytes() const noexcept { return max_bytes; };
+    size_t get_used_bytes() const noexcept { return used_bytes; };
+    void clear() noexcept;
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const T> value;
+    };
+
+    void erase(const typename std::list<Entry>::iterator it) noexcept;
+    void evict() noexcept;
+
+    size_t max_bytes;
+    size_t used_bytes {0};
+    std::list<Entry> entries {}; // Most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index {};
+};
+
+// Returns the cached value, marking it most recently used, or nullptr if there isn't one
+template <typename T>
+std::shared_ptr<const T> LRUByteCache<T>::find(const std::string& key) {
+    const auto it {index.find(key)};
+    if (it == index.end()) {
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->value;
+}
+
+// A value bigger than the whole budget isn't kept
+template <typename T>
+void LRUByteCache<T>::insert(const std::string& key, std::shared_ptr<const T> value) {
+    const auto it {index.find(key)};
+    if (it != index.end()) {
+        erase(it->second);
+    }
+
+    const size_t bytes {value->get_size()};
+    if (bytes > max_bytes) {
+        return;
+    }
+
+    entries.push_front(Entry{key, std::move(value)});
+    index[key] = entries.begin();
+    used_bytes += bytes;
+    evict();
+}
+
+template <typename T>
+void LRUByteCache<T>::set_max_bytes(const size_t bytes) noexcept {
+    max_bytes = bytes;
+    evict();
+}
+
+template <typename T>
+void LRUByteCache<T>::clear() noexcept {
+    index.clear();
+    entries.clear();
+    used_bytes = 0;
+}
+
+template <typename T>
+void LRUByteCache<T>::erase(const typename std::list<Entry>::iterator it) noexcept {
+    used_bytes -= it->value->get_size();
+    index.erase(it->key);
+    entries.erase(it);
+}
+
+// Drops least recently used values until the cache is within budget
+template <typename T>
+void LRUByteCache<T>::evict() noexcept {
+    while (used_bytes > max_bytes && !entries.empty()) {
+        erase(std::prev(entries.end()));
+    }
+}
+
+}
+
+#endif
@@ -25,6 +25,6 @@ int main(void) {
 
     screen.render();
 
-    while(1);
+    gui::DisplayManager::the().run();
 }
 
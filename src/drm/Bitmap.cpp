@@ -1,18 +1,24 @@
 #include "drm.h"
 #include "../gui/gui.h"
+#include "../logging/logging.h"
+#include "../trace/trace.h"
 #include <drm_fourcc.h>
 
 namespace drm {
 
+// Memory-backed bitmaps start out clear, with no storage
 Bitmap::Bitmap(const uint32_t width, const uint32_t height, const bool transparency, const bool hardware_backing) :
-    width{width}, height{height}, transparency{transparency}, hardware_backing{hardware_backing}, buffers{make_buffers()} {}
+        width{width}, height{height}, transparency{transparency}, hardware_backing{hardware_backing},
+        buffers{make_buffers()} {
+    if (!hardware_backing) {
+        solid = {0, 0};
+    }
+}
 
+// Framebuffers for a hardware plane have to exist to be scanned out, so only they are allocated up front
 std::array<std::unique_ptr<Buffer>, 2> Bitmap::make_buffers() const {
     if (!hardware_backing) {
-        return std::array<std::unique_ptr<Buffer>, 2>{
-            std::make_unique<MemBuffer>(width, height, 32), // TODO allow bpp configuration
-            std::make_unique<MemBuffer>(width, height, 32), // TODO allow bpp configuration
-        };
+        return {};
     }
 
     auto& card {gui::DisplayManager::the().get_drm_card()};
@@ -27,41 +33,183 @@ std::array<std::unique_ptr<Buffer>, 2> Bitmap::make_buffers() const {
     };
 }
 
-void Bitmap::render(Bitmap& target, const int32_t x, const int32_t y) {
-    // TODO: null check?
+// Allocates a buffer's storage if it doesn't have any, filling it with the colour it represented
+Buffer& Bitmap::materialise(const int index) {
+    if (!buffers[index]) {
+        buffers[index] = std::make_unique<MemBuffer>(width, height, 32); // TODO allow bpp configuration
+    }
+    if (solid[index]) {
+        buffers[index]->fill(style::Colour{*solid[index]});
+        solid[index].reset();
+    }
+    return *buffers[index];
+}
 
-    auto& src {*buffers[back]};
-    auto& dst {*target.buffers[target.back]};
+void Bitmap::fill(const style::Colour c) noexcept {
+    if (hardware_backing) {
+        buffers[back]->fill(c);
+        return;
+    }
+    solid[back] = c.to_int();
+    buffers[back].reset();
+}
 
-    src.paint(dst, x, y, transparency);
+void Bitmap::render(Bitmap& target, const int32_t x, const int32_t y) {
+    TRACE_SCOPE("Bitmap::render");
+    // A solid bitmap copied over the whole of another leaves it solid, so neither needs any storage
+    const auto src {get_viewport()};
+    const bool covers {x <= 0 && y <= 0 && int64_t{x} + src.w >= target.width && int64_t{y} + src.h >= target.height};
+    const auto shown {get_shown_solid()};
+    if (shown && covers && ((!transparency && is_plain()) || *shown >> 24 == 0xFF)) {
+        target.fill(style::Colour{*shown});
+    } else if (!(shown && (transparency || !is_plain()) && *shown >> 24 == 0)) {
+        paint_back_buffer(*target.get_back_buffer(), x, y);
+    }
 
     // TODO: do this here or in a separate refresh function?
     back ^= 1;
 }
 
+// Hardware-backed bitmaps are shown on their own plane, so scrolling the viewport, or changing the bitmap's opacity,
+// moves no pixels. If the plane can't show the bitmap as asked, it is painted into the screen's back buffer instead,
+// and the plane is taken off the screen so that its last frame isn't left showing on top
 void Bitmap::render(ScreenBitmap& target, const int32_t x, const int32_t y) {
-    // TODO: null check?
-
-    auto& src {*buffers[back]};
-
+    TRACE_SCOPE("Bitmap::render");
+    const DRMCRTC& crtc {target.get_crtc()};
+    const auto src {get_viewport()};
     if (hardware_backing) {
-        const DRMCRTC& crtc {target.get_crtc()};
-        auto& drm_src {static_cast<DRMFramebuffer&>(src)};
+        auto& drm_src {static_cast<DRMFramebuffer&>(*buffers[back])};
         DRMPlane& src_plane {drm_src.get_plane()}; // TODO: yuck! separate Bitmap and HardwareBitmap?
-        if (src_plane.is_compatible_with(crtc)) {
+        src_plane.set_composition(composition);
+        if (src_plane.is_compatible_with(crtc) && src_plane.can_compose(composition) &&
+                plane_accepts(src_plane, crtc, drm_src, src, x, y)) {
             target.render(); // TODO: necessary?
-            src_plane.repaint(crtc, drm_src, x, y);
-        } else {
-            // TODO: do something! Choose new plane?
+            try {
+                src_plane.repaint(crtc, drm_src, src, x, y);
+                on_plane = true;
+                back ^= 1;
+                return;
+            } catch (const DRMException& e) {
+                LOG_WARNING(e.what() << " (painting in software)");
+                tested_viewport.reset(); // Ask again next time, where the bitmap is then
+            }
+        }
+
+        if (on_plane) {
+            try {
+                src_plane.disable();
+                on_plane = false;
+            } catch (const DRMException& e) {
+                LOG_ERROR(e.what());
+            }
         }
-    } else {
-        DRMFramebuffer& dst {*target.get_back_buffer()};
-        src.paint(dst, x, y, transparency);
-        // TODO: target.render(); ? // TODO: copy new front buffer to back buffer?
     }
 
+    paint_back_buffer(*target.get_back_buffer(), x, y);
+    // TODO: target.render(); ? // TODO: copy new front buffer to back buffer?
+
     // TODO: do this here or in a separate refresh function?
     back ^= 1;
 }
 
+// Shows only part of the bitmap, e.g. to scroll through content larger than the space it is shown in. The viewport is
+// clipped to the bitmap
+void Bitmap::set_viewport(const int32_t src_x, const int32_t src_y, const uint32_t w, const uint32_t h) noexcept {
+    viewport = Rect{src_x, src_y, w, h}.intersect(Rect{0, 0, width, height});
+}
+
+// Sets the bitmap's place in the stacking order of the CRTC's planes. Only hardware-backed bitmaps shown on their own
+// plane are reordered; otherwise bitmaps are painted in the order they are rendered
+void Bitmap::set_zpos(const uint32_t zpos) noexcept {
+    composition.zpos = zpos;
+    tested_viewport.reset(); // The plane may not accept the new order
+}
+
+void Bitmap::set_blend_mode(const PlaneBlendMode mode) noexcept {
+    composition.blend_mode = mode;
+    tested_viewport.reset();
+}
+
+// Asks the plane with a TEST_ONLY commit whether it can show the viewport. A yes is kept until the viewport's size,
+// stacking order or blend mode changes, so neither scrolling nor fading costs a test per frame. A no only holds for
+// the exact viewport and position asked about, as the driver may have objected to either
+// TODO: some hardware has alignment limits on the source offset too
+bool Bitmap::plane_accepts(DRMPlane& plane, const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src, const int32_t x,
+        const int32_t y) {
+    const bool same_size {tested_viewport && tested_viewport->w == src.w && tested_viewport->h == src.h};
+    const bool same_place {same_size && tested_viewport->x == src.x && tested_viewport->y == src.y && tested_x == x &&
+        tested_y == y};
+    if (plane_accepted ? !same_size : !same_place) {
+        try {
+            plane_accepted = !src.is_empty() && plane.test(crtc, fb, src, x, y);
+        } catch (const DRMException& e) {
+            LOG_ERROR("failed to test plane: " << e.what());
+            plane_accepted = false;
+        }
+        tested_viewport = src;
+        tested_x = x;
+        tested_y = y;
+    }
+    return plane_accepted;
+}
+
+// Paints the viewport, with its top-left corner at (x, y)
+void Bitmap::paint_back_buffer(Buffer& dst, const int32_t x, const int32_t y) const noexcept {
+    composite(dst, get_viewport(), x, y, transparency);
+}
+
+// Paints part of the back buffer without flipping, for bitmaps which are kept as caches rather than redrawn each frame
+void Bitmap::composite(Buffer& dst, const Rect& area, const int32_t x, const int32_t y) const noexcept {
+    composite(dst, area, x, y, transparency);
+}
+
+// Like composite(), but over says whether to blend (as for a transparent bitmap) or copy. A bitmap with an opacity or
+// blend mode set is blended as its plane would blend it, with copying treated as the NONE blend mode
+void Bitmap::composite(Buffer& dst, const Rect& area, const int32_t x, const int32_t y, const bool over) const noexcept {
+    TRACE_SCOPE("Bitmap::composite");
+    if (!solid[back]) {
+        if (is_plain()) {
+            buffers[back]->paint(dst, area, x, y, over, blend_quality);
+        } else {
+            buffers[back]->paint_faded(dst, area, x, y, get_opacity(), over ? composition.blend_mode : PlaneBlendMode::NONE);
+        }
+        return;
+    }
+
+    const auto src_area {area.intersect(Rect{0, 0, width, height})};
+    const auto dst_area {src_area.translate(x - area.x, y - area.y)};
+    const style::Colour c {*get_shown_solid(over)};
+    if ((!over && is_plain()) || c.a == 0xFF) {
+        dst.fill(c, dst_area);
+    } else {
+        dst.blend_rect(c, dst_area);
+    }
+}
+
+// The colour a solid bitmap appears as once its opacity and blend mode are applied, if it is solid
+std::optional<uint32_t> Bitmap::get_shown_solid() const noexcept {
+    return get_shown_solid(transparency);
+}
+
+std::optional<uint32_t> Bitmap::get_shown_solid(const bool over) const noexcept {
+    if (!solid[back]) {
+        return std::nullopt;
+    }
+
+    const style::Colour c {*solid[back]};
+    if (is_plain()) {
+        return c.to_int();
+    }
+
+    const auto mode {over ? composition.blend_mode : PlaneBlendMode::NONE};
+
+    const uint32_t opacity {get_opacity()};
+    const uint32_t coverage {mode == PlaneBlendMode::COVERAGE ? c.a : 0xFFu}; // Straight alpha is premultiplied here
+    const auto scale {[opacity, coverage](const uint32_t v) {
+        return style::Colour::div255(style::Colour::div255(v * coverage) * opacity);
+    }};
+    const uint32_t a {mode == PlaneBlendMode::NONE ? 0xFFu : c.a};
+    return style::Colour::div255(a * opacity) << 24 | scale(c.r) << 16 | scale(c.g) << 8 | scale(c.b);
+}
+
 }
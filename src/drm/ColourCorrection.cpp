@@ -0,0 +1,70 @@
+#include "drm.h"
+#include <algorithm>
+#include <cmath>
+
+namespace drm {
+
+// Cuts blue and, less so, green, as a warm tint for use at night. A strength of 1 is roughly 2700K
+ColourCorrection ColourCorrection::night_mode(const float strength) noexcept {
+    const auto s {std::clamp(strength, 0.0f, 1.0f)};
+    ColourCorrection c {};
+    c.matrix[4] = 1.0f - 0.3f*s;
+    c.matrix[8] = 1.0f - 0.6f*s;
+    return c;
+}
+
+bool ColourCorrection::is_identity() const noexcept {
+    return is_diagonal() && matrix[0] == 1 && matrix[4] == 1 && matrix[8] == 1 && brightness == 1 && gamma == 1;
+}
+
+bool ColourCorrection::is_diagonal() const noexcept {
+    return matrix[1] == 0 && matrix[2] == 0 && matrix[3] == 0 && matrix[5] == 0 && matrix[6] == 0 && matrix[7] == 0;
+}
+
+// The whole correction for one channel of an encoded value, for diagonal matrices. channel is 0 for red, 1 for green
+// and 2 for blue
+float ColourCorrection::apply(const uint32_t channel, const float encoded) const noexcept {
+    const auto linear {std::clamp(style::srgb_to_linear(encoded) * matrix[channel * 4] * brightness, 0.0f, 1.0f)};
+    return std::pow(style::linear_to_srgb(linear), 1.0f / gamma);
+}
+
+// Decodes sRGB to linear light, so that the CTM works on linear values
+std::vector<drm_color_lut> ColourCorrection::degamma_lut(const uint32_t size) const {
+    std::vector<drm_color_lut> lut(size);
+    for (uint32_t i {0}; i < size; i++) {
+        const auto v {static_cast<uint16_t>(std::lround(style::srgb_to_linear(i / float(size - 1)) * 0xFFFF))};
+        lut[i] = drm_color_lut{v, v, v, 0};
+    }
+    return lut;
+}
+
+// With the matrix, the LUT maps encoded values straight to corrected ones and no CTM is needed. Without it, the LUT
+// maps the CTM's linear output back to encoded values
+std::vector<drm_color_lut> ColourCorrection::gamma_lut(const uint32_t size, const bool with_matrix) const {
+    std::vector<drm_color_lut> lut(size);
+    for (uint32_t i {0}; i < size; i++) {
+        const auto x {i / float(size - 1)};
+        uint16_t rgb[3];
+        for (uint32_t c {0}; c < 3; c++) {
+            const auto v {with_matrix ? apply(c, x) : std::pow(style::linear_to_srgb(x), 1.0f / gamma)};
+            rgb[c] = static_cast<uint16_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * 0xFFFF));
+        }
+        lut[i] = drm_color_lut{rgb[0], rgb[1], rgb[2], 0};
+    }
+    return lut;
+}
+
+// The CTM holds S31.32 sign-magnitude fixed point values, not two's complement
+drm_color_ctm ColourCorrection::ctm() const noexcept {
+    drm_color_ctm ctm {};
+    for (auto i {0}; i < 9; i++) {
+        const double v {double(matrix[i]) * brightness};
+        ctm.matrix[i] = static_cast<uint64_t>(std::llround(std::fabs(v) * 4294967296.0));
+        if (v < 0) {
+            ctm.matrix[i] |= uint64_t{1} << 63;
+        }
+    }
+    return ctm;
+}
+
+}
@@ -0,0 +1,62 @@
+#include "drm.h"
+#include <algorithm>
+#include <cmath>
+
+namespace drm {
+
+ColourTransform::ColourTransform(const ColourCorrection& correction) : diagonal{correction.is_diagonal()} {
+    if (diagonal) {
+        // Memory order is B, G, R; the correction's channels are R, G, B
+        for (uint32_t c {0}; c < 3; c++) {
+            for (uint32_t i {0}; i < 256; i++) {
+                channel_luts[2 - c][i] = static_cast<uint8_t>(std::lround(correction.apply(c, i / 255.0f) * 255));
+            }
+        }
+        return;
+    }
+
+    for (uint32_t i {0}; i < 256; i++) {
+        to_linear[i] = static_cast<uint16_t>(std::lround(style::srgb_to_linear(i / 255.0f) * 0xFFFF));
+    }
+    for (uint32_t i {0}; i < 4096; i++) {
+        const auto encoded {style::linear_to_srgb((i + 0.5f) / 4096)};
+        to_encoded[i] = static_cast<uint8_t>(std::lround(std::pow(encoded, 1.0f / correction.gamma) * 255));
+    }
+    for (uint32_t i {0}; i < 9; i++) {
+        matrix[i] = static_cast<int32_t>(std::lround(correction.matrix[i] * correction.brightness * 4096));
+    }
+}
+
+// Copies src to dst, correcting colours on the way. Alpha is copied unchanged
+void ColourTransform::apply(const Buffer& src, Buffer& dst) const noexcept {
+    const auto w {std::min(src.get_width(), dst.get_width())};
+    const auto h {std::min(src.get_height(), dst.get_height())};
+
+    for (uint32_t y {0}; y < h; y++) {
+        const uint32_t* in {reinterpret_cast<const uint32_t*>(src.get_buffer() + size_t(y)*src.get_stride())};
+        uint32_t* out {reinterpret_cast<uint32_t*>(dst.get_buffer() + size_t(y)*dst.get_stride())};
+
+        if (diagonal) {
+            for (uint32_t x {0}; x < w; x++) {
+                const auto v {in[x]};
+                out[x] = (v & 0xFF000000) | uint32_t{channel_luts[2][(v >> 16) & 0xFF]} << 16 |
+                    uint32_t{channel_luts[1][(v >> 8) & 0xFF]} << 8 | channel_luts[0][v & 0xFF];
+            }
+            continue;
+        }
+
+        for (uint32_t x {0}; x < w; x++) {
+            const auto v {in[x]};
+            const int64_t r {to_linear[(v >> 16) & 0xFF]}, g {to_linear[(v >> 8) & 0xFF]}, b {to_linear[v & 0xFF]};
+            uint32_t rgb[3];
+            for (uint32_t c {0}; c < 3; c++) {
+                // Q12 coefficients on 16-bit values, down to a 12-bit index
+                const auto linear {(matrix[c*3]*r + matrix[c*3 + 1]*g + matrix[c*3 + 2]*b) >> 16};
+                rgb[c] = to_encoded[std::clamp<int64_t>(linear, 0, 4095)];
+            }
+            out[x] = (v & 0xFF000000) | rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+        }
+    }
+}
+
+}
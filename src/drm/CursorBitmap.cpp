@@ -1,28 +1,211 @@
 #include "drm.h"
 #include "../gui/gui.h"
+#include "../logging/logging.h"
+#include <cerrno>
 #include <drm_fourcc.h>
 
 namespace drm {
 
 // TODO: make claim_unused_primary_plane atomic if threading is used
-CursorBitmap::CursorBitmap() : crtc{find_crtc()}, plane{crtc.claim_unused_cursor_plane()}, buffers{make_buffers()} {}
+CursorBitmap::CursorBitmap(ScreenBitmap* screen) :
+        screen{screen}, crtc{find_crtc()}, plane{claim_plane()}, width{fetch_width()}, height{fetch_height()},
+        buffers{make_buffers()}, save_unders{make_save_unders()} {
+    if (screen) {
+        screen->set_cursor(this);
+    }
+}
+
+// A software cursor takes itself out of the screen's framebuffers, leaving them as they were drawn
+CursorBitmap::~CursorBitmap() {
+    if (screen) {
+        screen->set_cursor(nullptr);
+    }
+    if (!plane) {
+        const auto front {screen->get_front()};
+        erase_from(front ^ 1);
+        const auto area {erase_from(front)};
+        try {
+            screen->get_framebuffer(front).mark_dirty({area});
+        } catch (const DRMException& e) {
+            LOG_ERROR("failed to flush cursor removal: " << e.what());
+        }
+    }
+}
 
 DRMCRTC& CursorBitmap::find_crtc() {
+    if (screen) {
+        return screen->get_crtc();
+    }
     auto& card {gui::DisplayManager::the().get_drm_card()};
     return card.get_connected_crtc(); // TODO: select "primary" crtc?
 }
 
-std::array<std::unique_ptr<DRMFramebuffer>, 2> CursorBitmap::make_buffers() const {
+// Without a cursor plane, the cursor can only be drawn in software, which needs a screen to draw into
+DRMPlane* CursorBitmap::claim_plane() const {
+    try {
+        return &crtc.claim_unused_cursor_plane();
+    } catch (const DRMException& e) {
+        if (!screen) {
+            throw;
+        }
+        LOG_INFO(e.what() << " (drawing the cursor in software)");
+        return nullptr;
+    }
+}
+
+// The driver's preferred cursor size, which is also used for software cursors. Cursor planes are usually 64x64
+uint32_t CursorBitmap::fetch_width() const {
+    try {
+        return gui::DisplayManager::the().get_drm_card().max_cursor_width();
+    } catch (const DRMException&) {
+        return 64;
+    }
+}
+
+uint32_t CursorBitmap::fetch_height() const {
+    try {
+        return gui::DisplayManager::the().get_drm_card().max_cursor_height();
+    } catch (const DRMException&) {
+        return 64;
+    }
+}
+
+std::array<std::unique_ptr<Buffer>, 2> CursorBitmap::make_buffers() const {
+    if (!plane) {
+        return std::array<std::unique_ptr<Buffer>, 2>{
+            std::make_unique<MemBuffer>(width, height, 32),
+            std::make_unique<MemBuffer>(width, height, 32),
+        };
+    }
     auto& card {gui::DisplayManager::the().get_drm_card()};
-    return std::array<std::unique_ptr<DRMFramebuffer>, 2>{
-        std::make_unique<DRMFramebuffer>(card, plane, width, height, 32, DRM_FORMAT_ARGB8888),
-        std::make_unique<DRMFramebuffer>(card, plane, width, height, 32, DRM_FORMAT_ARGB8888),
+    return std::array<std::unique_ptr<Buffer>, 2>{
+        std::make_unique<DRMFramebuffer>(card, *plane, width, height, 32, DRM_FORMAT_ARGB8888),
+        std::make_unique<DRMFramebuffer>(card, *plane, width, height, 32, DRM_FORMAT_ARGB8888),
+    };
+}
+
+std::array<std::unique_ptr<MemBuffer>, 2> CursorBitmap::make_save_unders() const {
+    if (plane) {
+        return {};
+    }
+    return std::array<std::unique_ptr<MemBuffer>, 2>{
+        std::make_unique<MemBuffer>(width, height, 32),
+        std::make_unique<MemBuffer>(width, height, 32),
     };
 }
 
 void CursorBitmap::render(const int32_t x, const int32_t y) {
-    plane.repaint(crtc, *buffers[back], x, y);
+    if (!plane) {
+        back ^= 1;
+        redraw(x, y);
+        return;
+    }
+    plane->repaint(crtc, static_cast<DRMFramebuffer&>(*buffers[back]), x, y);
     back ^= 1;
+    this->x = x;
+    this->y = y;
+    positioned = true;
+    folded.reset();
+}
+
+// Moves the cursor shown by the last render() without waiting for the next vblank. Returns false if the move should be
+// tried again after the next vblank, because the previous move hasn't taken effect yet or another commit to the CRTC
+// is in flight. While the screen has a flip pending, the move is also handed to the screen, to ride on its next
+// commit, so the cursor keeps up while something is being animated. Other failures are logged and the move dropped.
+// A software cursor moves at once and never returns false
+bool CursorBitmap::move(const int32_t x, const int32_t y) {
+    if (!plane) {
+        redraw(x, y);
+        return true;
+    }
+    if (positioned && x == this->x && y == this->y) {
+        return true; // Already shown, or carried by the screen's last commit
+    }
+    if (move_pending) {
+        return false;
+    }
+    if (screen && screen->is_flip_pending() && gui::DisplayManager::the().get_drm_card().are_atomic_commits_enabled()) {
+        folded = std::make_pair(x, y);
+        return false;
+    }
+
+    try {
+        move_pending = plane->repaint(crtc, static_cast<DRMFramebuffer&>(*buffers[back ^ 1]), x, y,
+            static_cast<FlipListener*>(this));
+    } catch (const DRMException& e) {
+        if (e.get_errnum() == EBUSY) {
+            return false;
+        }
+        LOG_ERROR("failed to move cursor: " << e.what());
+        return true;
+    }
+    this->x = x;
+    this->y = y;
+    positioned = true;
+    folded.reset();
+    return true;
+}
+
+// Adds a move waiting for the screen's next commit to that commit. Returns whether there was one
+bool CursorBitmap::add_to_request(const DRMAtomicRequest& req) const {
+    if (!folded || !plane) {
+        return false;
+    }
+    plane->add_to_request(req, crtc, static_cast<DRMFramebuffer&>(*buffers[back ^ 1]), folded->first, folded->second);
+    return true;
+}
+
+// Called by the screen once the commit carrying the folded move has been accepted
+void CursorBitmap::committed() noexcept {
+    if (folded) {
+        x = folded->first;
+        y = folded->second;
+        positioned = true;
+        folded.reset();
+    }
+}
+
+// Redraws a software cursor in the framebuffer being shown, without waiting for a new frame. This tears if it lands
+// mid-scanout, but only within the two cursor-sized rectangles it touches
+void CursorBitmap::redraw(const int32_t new_x, const int32_t new_y) {
+    const auto front {screen->get_front()};
+    const auto old_area {erase_from(front)};
+    x = new_x;
+    y = new_y;
+    const auto new_area {draw_into(front)};
+    try {
+        screen->get_framebuffer(front).mark_dirty({old_area, new_area});
+    } catch (const DRMException& e) {
+        LOG_ERROR("failed to flush cursor: " << e.what());
+    }
+}
+
+// Saves the pixels under the cursor in the given framebuffer, then blends the cursor over them. Returns the area drawn
+Rect CursorBitmap::draw_into(const int index) noexcept {
+    if (saved_areas[index]) {
+        return Rect{};
+    }
+    Buffer& fb {screen->get_framebuffer(index)};
+    const auto area {Rect{x, y, width, height}.intersect(fb.get_bounds())};
+    if (!area.is_empty()) {
+        fb.paint(*save_unders[index], area, 0, 0, false);
+        buffers[back ^ 1]->paint(fb, x, y, true);
+    }
+    saved_areas[index] = area;
+    return area;
+}
+
+// Puts back the pixels the cursor covered in the given framebuffer. Returns the area restored
+Rect CursorBitmap::erase_from(const int index) noexcept {
+    if (!saved_areas[index]) {
+        return Rect{};
+    }
+    const auto area {*saved_areas[index]};
+    saved_areas[index].reset();
+    if (!area.is_empty()) {
+        save_unders[index]->paint(screen->get_framebuffer(index), Rect{0, 0, area.w, area.h}, area.x, area.y, false);
+    }
+    return area;
 }
 
 }
@@ -1,4 +1,5 @@
 #include "drm.h"
+#include "../trace/trace.h"
 #include <cstring>
 
 namespace drm {
@@ -20,6 +21,7 @@ DRMAtomicRequest::~DRMAtomicRequest() {
 void DRMAtomicRequest::add_property(const uint32_t obj_id, const uint32_t obj_type, const char* prop_name,
     const uint64_t val) const
 {
+    TRACE_SCOPE("DRMAtomicRequest::add_property");
     uint32_t prop_id {0};
     const auto props {drmModeObjectGetProperties(card.get_fd(), obj_id, obj_type)};
     if (!props) {
@@ -49,12 +51,13 @@ void DRMAtomicRequest::add_property(const uint32_t obj_id, const uint32_t obj_ty
     }
 }
 
-void DRMAtomicRequest::commit(const uint32_t flags) const {
-    const auto res {drmModeAtomicCommit(card.get_fd(), req, flags, nullptr)};
-    if (res == -1) {
-        throw DRMException{"failed to modeset atomically: null request"};
-    } else if (res == -EINVAL) {
-        throw DRMException{"failed to modeset atomically", errno};
+// user_data is passed back in the page-flip event, if DRM_MODE_PAGE_FLIP_EVENT is set. libdrm returns -errno, so
+// every failure is reported, EBUSY from a commit still in flight included
+void DRMAtomicRequest::commit(const uint32_t flags, void* user_data) const {
+    TRACE_SCOPE("DRMAtomicRequest::commit");
+    const auto res {drmModeAtomicCommit(card.get_fd(), req, flags, user_data)};
+    if (res < 0) {
+        throw DRMException{"failed to commit atomically", -res};
     }
 }
 
@@ -62,4 +65,10 @@ void DRMAtomicRequest::commit() const {
     commit(0);
 }
 
+// Checks whether the driver would accept the request, without applying it
+bool DRMAtomicRequest::test() const noexcept {
+    TRACE_SCOPE("DRMAtomicRequest::test");
+    return drmModeAtomicCommit(card.get_fd(), req, DRM_MODE_ATOMIC_TEST_ONLY, nullptr) == 0;
+}
+
 }
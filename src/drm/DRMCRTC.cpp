@@ -1,4 +1,6 @@
 #include "drm.h"
+#include "../trace/trace.h"
+#include <algorithm>
 #include <drm_fourcc.h>
 #include <iostream>
 
@@ -12,48 +14,77 @@ bool DRMCRTC::is_connected() const noexcept {
 }
 
 void DRMCRTC::modeset(const DRMConnector& conn) {
+    TRACE_SCOPE("DRMCRTC::modeset");
     try {
         // TODO: work out how adding subsequent connectors will work (e.g. don't modeset again, make sure they have the right modes)
         // TODO: only do this after successful modeset
         add_connector(conn);
 
-        // TODO: allow configuration of this
-        // Pick the first mode
-        drmModeModeInfo mode {conn.fetch_modes()[0]};
-
-        if (card.are_atomic_commits_enabled()) {
-            const DRMPropertyBlob mode_blob {card, &mode};
-
-            // Submit an atomic commit with ALLOW_MODESET
-            const DRMAtomicRequest req {card};
-            req.add_property(id, DRM_MODE_OBJECT_CRTC, "MODE_ID", mode_blob.get_id());
-            req.add_property(id, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1);
-
-            for (const auto& conn_id: connector_ids) {
-                req.add_property(conn_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", id);
-            }
-
-            //const uint32_t flags {DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_ATOMIC_ALLOW_MODESET};
-            req.commit(/* flags */);
-        } else {
-            const auto res {drmModeSetCrtc(card.get_fd(), id, -1, 0, 0, connector_ids.data(), connector_ids.size(), &mode)};
-            if (res == -1) {
-                throw DRMException{"invalid list of connectors"};
-            } else if (res == -EINVAL) {
-                throw DRMException{"invalid CRTC id"};
-            } else if (res < 0) {
-                throw DRMException{errno};
-            }
+        // A full modeset blanks the screen for hundreds of milliseconds, so keep the mode left by the
+        // firmware or the previous DRM master if it is still valid. The first repaint is then a plain flip
+        if (can_inherit(conn)) {
+            return;
         }
 
+        apply_mode(conn.select_mode());
+
+        // The connector's snapshot still refers to its old encoder routing
+        conn.invalidate();
     } catch (const DRMException& e) {
         throw DRMException{"failed to modeset", e};
     }
 }
 
+std::optional<DRMMode> DRMCRTC::fetch_current_mode() const {
+    const auto crtc {fetch_resource()};
+    if (!crtc->mode_valid) {
+        return std::nullopt;
+    }
+    return DRMMode{crtc->mode};
+}
+
+bool DRMCRTC::can_inherit(const DRMConnector& conn) const {
+    const auto current_mode {fetch_current_mode()};
+    return current_mode && conn.fetch_crtc_id() == id && conn.supports_mode(*current_mode);
+}
+
+void DRMCRTC::apply_mode(const DRMMode& mode) {
+    drmModeModeInfo info {mode.get_info()};
+
+    if (card.are_atomic_commits_enabled()) {
+        const DRMPropertyBlob mode_blob {card, &info};
+
+        // Submit an atomic commit with ALLOW_MODESET
+        const DRMAtomicRequest req {card};
+        req.add_property(id, DRM_MODE_OBJECT_CRTC, "MODE_ID", mode_blob.get_id());
+        req.add_property(id, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1);
+
+        for (const auto& conn_id: connector_ids) {
+            req.add_property(conn_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", id);
+        }
+
+        req.commit(DRM_MODE_ATOMIC_ALLOW_MODESET);
+    } else {
+        const auto res {drmModeSetCrtc(card.get_fd(), id, -1, 0, 0, connector_ids.data(), connector_ids.size(), &info)};
+        if (res == -1) {
+            throw DRMException{"invalid list of connectors"};
+        } else if (res == -EINVAL) {
+            throw DRMException{"invalid CRTC id"};
+        } else if (res < 0) {
+            throw DRMException{errno};
+        }
+    }
+}
+
 void DRMCRTC::add_connector(const DRMConnector& conn) noexcept {
     // TODO: make sure connector isn't connected elsewhere first
-    connector_ids.push_back(conn.get_id());
+    if (std::find(connector_ids.begin(), connector_ids.end(), conn.get_id()) == connector_ids.end()) {
+        connector_ids.push_back(conn.get_id());
+    }
+}
+
+void DRMCRTC::remove_connector(const uint32_t conn_id) noexcept {
+    connector_ids.erase(std::remove(connector_ids.begin(), connector_ids.end(), conn_id), connector_ids.end());
 }
 
 DRMPlane& DRMCRTC::claim_unused_primary_plane() const {
@@ -74,6 +105,12 @@ DRMPlane& DRMCRTC::claim_unused_overlay_plane() const {
     return plane;
 }
 
+DRMPlane& DRMCRTC::claim_unused_overlay_plane(const uint32_t format) const {
+    auto& plane {card.get_unused_overlay_plane(*this, format)};
+    plane.claim();
+    return plane;
+}
+
 DRMModeCRTCUniquePtr DRMCRTC::fetch_resource() const {
     DRMModeCRTCUniquePtr crtc {drmModeGetCrtc(card.get_fd(), id), drmModeFreeCrtc};
     if (!crtc) {
@@ -100,6 +137,51 @@ int32_t DRMCRTC::get_y() const {
     return fetch_resource()->y;
 }
 
+// Programs the CRTC's colour pipeline with an atomic commit, so that changing the correction costs one commit rather
+// than a pass over every pixel of every frame. Diagonal corrections need only GAMMA_LUT; others need DEGAMMA_LUT and
+// CTM as well. Returns false, changing nothing, if the CRTC lacks what the correction needs
+bool DRMCRTC::set_colour_correction(const ColourCorrection& correction) {
+    TRACE_SCOPE("DRMCRTC::set_colour_correction");
+    if (!card.are_atomic_commits_enabled()) {
+        return false;
+    }
+
+    const DRMProperties props {card, id, DRM_MODE_OBJECT_CRTC};
+    const bool has_gamma {props.has("GAMMA_LUT") && props.has("GAMMA_LUT_SIZE")};
+    const bool has_degamma {props.has("DEGAMMA_LUT") && props.has("DEGAMMA_LUT_SIZE")};
+    const bool has_ctm {props.has("CTM")};
+    const bool full {!correction.is_diagonal()};
+    if (!has_gamma || (full && !(has_degamma && has_ctm))) {
+        return false;
+    }
+
+    // The kernel keeps its own reference to the blobs, so they can be destroyed once committed
+    std::unique_ptr<DRMPropertyBlob> gamma {}, degamma {}, ctm {};
+    if (!correction.is_identity()) {
+        const auto lut {correction.gamma_lut(props["GAMMA_LUT_SIZE"], !full)};
+        gamma = std::make_unique<DRMPropertyBlob>(card, lut.data(), lut.size() * sizeof(lut[0]));
+        if (full) {
+            const auto degamma_lut {correction.degamma_lut(props["DEGAMMA_LUT_SIZE"])};
+            degamma = std::make_unique<DRMPropertyBlob>(card, degamma_lut.data(),
+                degamma_lut.size() * sizeof(degamma_lut[0]));
+            const auto matrix {correction.ctm()};
+            ctm = std::make_unique<DRMPropertyBlob>(card, &matrix, sizeof(matrix));
+        }
+    }
+
+    // A blob ID of 0 resets a stage to pass values through unchanged
+    const DRMAtomicRequest req {card};
+    req.add_property(id, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT", gamma ? gamma->get_id() : 0);
+    if (has_degamma) {
+        req.add_property(id, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT", degamma ? degamma->get_id() : 0);
+    }
+    if (has_ctm) {
+        req.add_property(id, DRM_MODE_OBJECT_CRTC, "CTM", ctm ? ctm->get_id() : 0);
+    }
+    req.commit();
+    return true;
+}
+
 std::string DRMCRTC::to_string() const noexcept {
     std::string s {"DRMCRTC{"};
     s += "id=" + std::to_string(id);
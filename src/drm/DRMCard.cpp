@@ -1,6 +1,7 @@
 #include "drm.h"
+#include "../logging/logging.h"
 #include <fcntl.h>
-#include <iostream>
+#include <unistd.h>
 
 namespace drm {
 
@@ -52,6 +53,20 @@ DRMPlane& DRMCard::get_unused_overlay_plane(const DRMCRTC& crtc) {
     throw DRMException{"no unused overlay planes compatible with CRTC #" + std::to_string(crtc.get_id())};
 }
 
+// Finds an overlay plane which can scan out buffers in the given format, e.g. for video in NV12
+DRMPlane& DRMCard::get_unused_overlay_plane(const DRMCRTC& crtc, const uint32_t format) {
+    for (const auto id: plane_ids) {
+        auto& plane {planes.at(id)};
+        if (plane.is_overlay_plane() && !plane.is_in_use() && plane.is_compatible_with(crtc) &&
+                plane.supports_format(format)) {
+            return plane;
+        }
+    }
+
+    throw DRMException{"no unused overlay planes supporting the format compatible with CRTC #" +
+        std::to_string(crtc.get_id())};
+}
+
 DRMPlane& DRMCard::get_unused_primary_plane(const DRMCRTC& crtc) {
     for (const auto id: plane_ids) {
         auto& plane {planes.at(id)};
@@ -82,17 +97,16 @@ void DRMCard::set_capabilities() {
     // TODO: set capabilities in one place
     // TODO: handle the cases where setting capabilities fail
     // TODO: make this a config option?
-    // TODO: structured logging
     try {
         enable_universal_planes(); // TODO: for universal planes, ensure each CRTC gets its primary plane
     } catch (const DRMException& e) {
-        std::cerr << e.what() << " (continuing)" << std::endl;
+        LOG_WARNING(e.what() << " (continuing)");
     }
 
     try {
         enable_atomic_commits();
     } catch (const DRMException& e) {
-        std::cerr << e.what() << " (continuing)" << std::endl;
+        LOG_WARNING(e.what() << " (continuing)");
     }
 }
 
@@ -110,6 +124,9 @@ void DRMCard::load_resources() {
 
     for (auto i {0}; i < res->count_connectors; i++) {
         const auto id {res->connectors[i]};
+        if (writeback_connectors_enabled && is_writeback_connector(id)) {
+            continue; // Not a display: see find_writeback_connector
+        }
         connectors.emplace(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple(*this, id));
     }
 
@@ -139,19 +156,40 @@ void DRMCard::load_resources() {
 
 void DRMCard::configure_connectors() noexcept {
     for (auto& [id, conn]: connectors) {
-        if (!conn.is_connected()) {
-            continue;
-        }
-
         try {
+            if (!conn.is_connected()) {
+                continue;
+            }
+
             auto& crtc {conn.select_crtc()};
             crtc.modeset(conn);
         } catch (const DRMException& e) {
-            std::cerr << "failed to configure connector #" << id << ": " << e.what() << std::endl;
+            LOG_ERROR("failed to configure connector #" << id << ": " << e.what());
         }
     }
 }
 
+// Connector state is otherwise served from each connector's snapshot, so only a hotplug pays for a full probe.
+// Connectors which have gone, or can no longer be probed, are taken off their CRTCs before the rest are reconfigured
+void DRMCard::handle_hotplug() noexcept {
+    for (auto& [id, conn]: connectors) {
+        bool connected {false};
+        try {
+            conn.probe(true);
+            connected = conn.is_connected();
+        } catch (const DRMException& e) {
+            LOG_ERROR("failed to probe connector #" << id << ": " << e.what());
+        }
+        if (!connected) {
+            for (auto& [crtc_id, crtc]: crtcs) {
+                crtc.remove_connector(id);
+            }
+        }
+    }
+
+    configure_connectors();
+}
+
 uint64_t DRMCard::fetch_capability(const uint64_t capability) const {
     uint64_t value;
     if (drmGetCap(fd, capability, &value) < 0) {
@@ -168,11 +206,14 @@ bool DRMCard::supports_dumb_buffers() const {
     return fetch_capability(DRM_CAP_DUMB_BUFFER) == 1;
 }
 
+bool DRMCard::supports_prime_import() const {
+    return (fetch_capability(DRM_CAP_PRIME) & DRM_PRIME_CAP_IMPORT) != 0;
+}
+
 bool DRMCard::supports_monotonic_timestamp() const {
     return fetch_capability(DRM_CAP_TIMESTAMP_MONOTONIC) == 1;
 }
 
-// TODO: use these
 /* Hint to userspace of max cursor width */
 uint64_t DRMCard::max_cursor_width() const {
     return fetch_capability(DRM_CAP_CURSOR_WIDTH);
@@ -196,6 +237,47 @@ void DRMCard::enable_atomic_commits() {
     atomic_commits_enabled = true;
 }
 
+// Writeback connectors are hidden unless asked for, and need atomic commits. They are never added to the card's
+// connectors, so they can't be mistaken for displays
+bool DRMCard::enable_writeback_connectors() noexcept {
+    if (!writeback_connectors_enabled) {
+        writeback_connectors_enabled = atomic_commits_enabled &&
+            drmSetClientCap(fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1) == 0;
+    }
+    return writeback_connectors_enabled;
+}
+
+bool DRMCard::is_writeback_connector(const uint32_t id) const {
+    DRMModeConnUniquePtr conn {drmModeGetConnectorCurrent(fd, id), drmModeFreeConnector};
+    return conn && conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK;
+}
+
+// Returns the ID of a writeback connector which can be attached to crtc, or 0 if there isn't one
+uint32_t DRMCard::find_writeback_connector(const DRMCRTC& crtc) const {
+    if (!writeback_connectors_enabled) {
+        return 0;
+    }
+
+    DRMModeResUniquePtr res {drmModeGetResources(fd), drmModeFreeResources};
+    if (!res) {
+        throw DRMException{"cannot fetch resources for card", errno};
+    }
+
+    for (auto i {0}; i < res->count_connectors; i++) {
+        DRMModeConnUniquePtr conn {drmModeGetConnectorCurrent(fd, res->connectors[i]), drmModeFreeConnector};
+        if (!conn || conn->connector_type != DRM_MODE_CONNECTOR_WRITEBACK) {
+            continue;
+        }
+        for (auto j {0}; j < conn->count_encoders; j++) {
+            DRMModeEncoderUniquePtr enc {drmModeGetEncoder(fd, conn->encoders[j]), drmModeFreeEncoder};
+            if (enc && (enc->possible_crtcs & (1 << crtc.get_index()))) {
+                return conn->connector_id;
+            }
+        }
+    }
+    return 0;
+}
+
 int DRMCard::open_device(const std::string& path) const {
 	auto fd {open(path.c_str(), O_CLOEXEC | O_RDWR)};
 	if (fd < 0) {
@@ -1,58 +1,87 @@
 #include "drm.h"
+#include "../logging/logging.h"
+#include <algorithm>
 #include <cassert>
-#include <iostream>
 
 namespace drm {
 
 DRMConnector::DRMConnector(DRMCard& card, const uint32_t id) noexcept : card{card}, id{id} {}
 
 DRMCRTC& DRMConnector::select_crtc() const {
-    for (const auto& enc_id: fetch_encoder_ids()) {
+    for (const auto& enc_id: get_encoder_ids()) {
         try {
             const auto& encoder {card.get_encoder_by_id(enc_id)};
             // TODO: set the encoder for this CRTC once we've found a CRTC
             return encoder.select_crtc();
         } catch (const DRMException& e) {
-            std::cerr << "failed to select CRTC for connector #" << id << ": " << e.what() << std::endl;
+            LOG_ERROR("failed to select CRTC for connector #" << id << ": " << e.what());
         }
     }
 
     throw DRMException{"cannot find suitable CRTC for connector #" + std::to_string(id)};
 }
 
-DRMModeConnUniquePtr DRMConnector::fetch_resource() const {
-    DRMModeConnUniquePtr conn {drmModeGetConnector(card.get_fd(), id), drmModeFreeConnector};
+// A forced fetch makes the kernel probe the hardware (DDC/EDID reads, often tens of milliseconds), whereas
+// an unforced fetch returns whatever the kernel last saw
+DRMModeConnUniquePtr DRMConnector::fetch_resource(const bool force) const {
+    const auto fetch {force ? drmModeGetConnector : drmModeGetConnectorCurrent};
+    DRMModeConnUniquePtr conn {fetch(card.get_fd(), id), drmModeFreeConnector};
     if (!conn) {
         throw DRMException{"cannot fetch connector resource", errno};
     }
     return conn;
 }
 
-bool DRMConnector::is_connected() const {
-    const auto conn {fetch_resource()};
-    return conn->connection == DRM_MODE_CONNECTED;
-}
+void DRMConnector::probe(const bool force) const {
+    auto conn {fetch_resource(force)};
 
-//TODO: return by value? move?
-std::vector<drmModeModeInfo> DRMConnector::fetch_modes() const {
-    const auto conn {fetch_resource()};
+    // The kernel has no mode list for a connector that has never been probed, so fall back to a full probe
+    if (!force && conn->connection != DRM_MODE_DISCONNECTED && conn->count_modes == 0) {
+        conn = fetch_resource(true);
+    }
 
-    std::vector<drmModeModeInfo> modes;
+    DRMConnectorState new_state {conn->connection, conn->encoder_id, {}, {}};
     for (auto i {0}; i < conn->count_modes; i++) {
-        modes.push_back(conn->modes[i]);
+        new_state.modes.emplace_back(conn->modes[i]);
+    }
+    for (auto i {0}; i < conn->count_encoders; i++) {
+        new_state.encoder_ids.push_back(conn->encoders[i]);
+    }
+    state = std::move(new_state);
+}
+
+const DRMConnectorState& DRMConnector::get_state() const {
+    if (!state) {
+        probe(false);
     }
-    return modes;
+    return *state;
 }
 
-//TODO: replace uint32_t with a type alias
-std::vector<uint32_t> DRMConnector::fetch_encoder_ids() const {
-    const auto conn {fetch_resource()}; // TODO: avoid duplicating work between calls to fetch_modes and fetch_encoder_ids
+// TODO: allow configuration of this
+DRMMode DRMConnector::select_mode() const {
+    const auto& modes {get_modes()};
+    if (modes.empty()) {
+        throw DRMException{"no modes available for connector #" + std::to_string(id)};
+    }
+
+    const auto best {std::min_element(modes.begin(), modes.end(), [](const auto& a, const auto& b) {
+        return a.is_better_than(b);
+    })};
+    return *best;
+}
+
+bool DRMConnector::supports_mode(const DRMMode& mode) const {
+    const auto& modes {get_modes()};
+    return std::find(modes.begin(), modes.end(), mode) != modes.end();
+}
 
-    std::vector<uint32_t> encoder_ids;
-    for (int i {0}; i < conn->count_encoders; i++) {
-        encoder_ids.emplace_back(conn->encoders[i]);
+// Returns the ID of the CRTC currently driving this connector, or 0 if there is none
+uint32_t DRMConnector::fetch_crtc_id() const {
+    const auto encoder_id {get_state().encoder_id};
+    if (!encoder_id) {
+        return 0;
     }
-    return encoder_ids;
+    return card.get_encoder_by_id(encoder_id).fetch_crtc_id();
 }
 
 // TODO: is to_string idiomatic?
@@ -6,7 +6,7 @@ DRMEncoder::DRMEncoder(DRMCard& card, const uint32_t id) : card{card}, id{id} {}
 
 DRMCRTC& DRMEncoder::select_crtc() const {
     // Use connected CRTC, if there is one
-    const auto crtc_id {fetch_resource()->crtc_id};
+    const auto crtc_id {fetch_crtc_id()};
     if (crtc_id) {
         return card.get_crtc_by_id(crtc_id);
     }
@@ -3,17 +3,23 @@
 
 namespace drm {
 
+static int errnum_of(const std::exception& e) noexcept {
+    const auto drm_e {dynamic_cast<const DRMException*>(&e)};
+    return drm_e ? drm_e->get_errnum() : 0;
+}
+
 DRMException::DRMException(const std::string msg) noexcept : std::runtime_error(msg) {}
 
-DRMException::DRMException(const int errnum) noexcept : std::runtime_error(std::strerror(errnum)) {}
+DRMException::DRMException(const int errnum) noexcept : std::runtime_error(std::strerror(errnum)), errnum{errnum} {}
 
 DRMException::DRMException(const std::string msg, const int errnum) noexcept :
-        std::runtime_error(msg + ": " + std::strerror(errnum)) {}
+        std::runtime_error(msg + ": " + std::strerror(errnum)), errnum{errnum} {}
 
+// Wrapping keeps the cause's errno, so callers can still tell e.g. EBUSY from other failures
 DRMException::DRMException(const std::string msg, const std::exception& e) noexcept :
-        std::runtime_error(msg + ": " + e.what()) {}
+        std::runtime_error(msg + ": " + e.what()), errnum{errnum_of(e)} {}
 
 DRMException::DRMException(const std::exception& e, const std::string extra) noexcept :
-        std::runtime_error(std::string(e.what()) + " (also: " + extra + ")") {}
+        std::runtime_error(std::string(e.what()) + " (also: " + extra + ")"), errnum{errnum_of(e)} {}
 
 }
@@ -1,20 +1,40 @@
 #include "drm.h"
+#include "../logging/logging.h"
+#include <drm_fourcc.h>
 #include <cstring>
-#include <iostream>
 #include <cstdio>
+#include <fcntl.h>
+#include <linux/dma-buf.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <xf86drmMode.h>
 #include <xf86drm.h>
 
 namespace drm {
 
+// bpp is per pixel of the first plane: 8 for NV12, whose chroma plane follows its luma plane in the same dumb buffer,
+// and 16 for YUYV. The pixels of YUV framebuffers are for scanning out, not for painting as ARGB
 // TODO: derive bpp from pixel_format
 // TODO: reject attempts to make buffers that are too small (< 6x6? Determine from properties?)
 // TODO: disallow buffer_type == MEMORY
 DRMFramebuffer::DRMFramebuffer(const DRMCard& card, DRMPlane& plane, const uint32_t w, const uint32_t h,
         const uint32_t bpp, const uint32_t pixel_format) :
-        card{card}, plane{plane}, info{h, w, bpp, 0, 0, 0, 0}, pixel_format{pixel_format}
+        DRMFramebuffer{card, &plane, w, h, bpp, pixel_format} {}
+
+// A framebuffer which is never scanned out, such as a writeback target, belongs to no plane
+DRMFramebuffer::DRMFramebuffer(const DRMCard& card, const uint32_t w, const uint32_t h, const uint32_t bpp,
+        const uint32_t pixel_format) :
+        DRMFramebuffer{card, nullptr, w, h, bpp, pixel_format} {}
+
+DRMFramebuffer::DRMFramebuffer(const DRMCard& card, DRMPlane* plane, const uint32_t w, const uint32_t h,
+        const uint32_t bpp, const uint32_t pixel_format) :
+        card{card}, plane{plane}, info{get_dumb_height(h, pixel_format), w, bpp, 0, 0, 0, 0},
+        pixel_format{pixel_format}, height{h}
 {
+    if ((pixel_format == DRM_FORMAT_NV12 && (w % 2 || h % 2)) || (pixel_format == DRM_FORMAT_YUYV && w % 2)) {
+        throw DRMException{"chroma-subsampled framebuffers must have even dimensions"};
+    }
+
     const auto fd {card.get_fd()};
 
     create_dumb_buffer();
@@ -45,20 +65,140 @@ DRMFramebuffer::DRMFramebuffer(const DRMCard& card, DRMPlane& plane, const uint3
     }
 }
 
+// Wraps a buffer allocated elsewhere (a decoder, a camera, another process) so that it can be scanned out or
+// composited without copying. The caller keeps ownership of dmabuf_fd, which may be closed after construction.
+// NB: importing the same dma-buf twice on one card yields the same GEM handle, so each dma-buf should only be
+// wrapped by one DRMFramebuffer at a time. The exporting device may be using the buffer too, so CPU access to its
+// pixels must be bracketed with begin_cpu_access() and end_cpu_access(), or a CPUAccess
+DRMFramebuffer::DRMFramebuffer(const DRMCard& card, DRMPlane& plane, const int dmabuf_fd, const uint32_t w,
+        const uint32_t h, const uint32_t stride, const uint32_t pixel_format) :
+        card{card}, plane{&plane}, info{get_dumb_height(h, pixel_format), w, get_bpp(pixel_format), 0, 0, stride,
+            uint64_t{stride} * get_dumb_height(h, pixel_format)},
+        pixel_format{pixel_format}, height{h}, imported{true}
+{
+    import_dmabuf(dmabuf_fd);
+
+    try {
+        add_framebuffer();
+
+        try {
+            map_dmabuf(dmabuf_fd);
+        } catch (const DRMException& e) {
+            if (drmModeRmFB(card.get_fd(), id) < 0) {
+                throw DRMException{e, "failed to remove framebuffer during cleanup"};
+            }
+
+            throw e;
+        }
+    } catch (const DRMException& e) {
+        if (!close_handle()) {
+            throw DRMException{e, "failed to close imported buffer handle during cleanup"};
+        }
+
+        throw e;
+    }
+
+    this->dmabuf_fd = fcntl(dmabuf_fd, F_DUPFD_CLOEXEC, 0);
+    if (this->dmabuf_fd < 0) {
+        LOG_WARNING("failed to duplicate dma-buf fd, so CPU access won't be synced: " << std::strerror(errno));
+    }
+}
+
 DRMFramebuffer::~DRMFramebuffer() {
     const auto fd {card.get_fd()};
 
+    if (munmap(buffer, info.size) < 0) {
+        LOG_ERROR("failed to unmap framebuffer");
+    }
+
     if (drmModeRmFB(fd, id) < 0) {
-        std::cerr << "failed to remove framebuffer" << std::endl;
+        LOG_ERROR("failed to remove framebuffer");
+    }
+
+    if (imported) {
+        if (!close_handle()) {
+            LOG_ERROR("failed to close imported buffer handle");
+        }
+        if (dmabuf_fd >= 0) {
+            close(dmabuf_fd);
+        }
+    } else {
+        struct drm_mode_destroy_dumb destroy_buf;
+        destroy_buf.handle = info.handle;
+        if (drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_buf) < 0) {
+            LOG_ERROR("failed to destroy dumb buffer");
+        }
     }
 
-    struct drm_mode_destroy_dumb destroy_buf;
-    destroy_buf.handle = info.handle;
-    if (drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_buf) < 0) {
-        std::cerr << "failed to destroy dumb buffer" << std::endl;
+    if (plane) {
+        plane->release();
     }
+}
+
+uint32_t DRMFramebuffer::get_dumb_height(const uint32_t h, const uint32_t pixel_format) {
+    return pixel_format == DRM_FORMAT_NV12 ? h + h / 2 : h;
+}
+
+// Bits per pixel of the first plane, which is all the kernel's size and pitch checks look at
+uint32_t DRMFramebuffer::get_bpp(const uint32_t pixel_format) {
+    switch (pixel_format) {
+        case DRM_FORMAT_NV12:
+            return 8;
+        case DRM_FORMAT_YUYV:
+        case DRM_FORMAT_RGB565:
+            return 16;
+        default:
+            return 32;
+    }
+}
+
+// Waits for any device access to an imported buffer to finish, and makes the CPU's view of it coherent. Dumb buffers
+// are only ever touched by the CPU and the display, so need nothing
+void DRMFramebuffer::begin_cpu_access(const bool write) const {
+    if (dmabuf_fd < 0) {
+        return;
+    }
+    const auto direction {static_cast<uint64_t>(write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ)};
+    struct dma_buf_sync sync {DMA_BUF_SYNC_START | direction};
+    if (drmIoctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+        throw DRMException{"failed to begin CPU access to dma-buf", errno};
+    }
+}
+
+// Flushes the CPU's writes, if any, so devices see them
+void DRMFramebuffer::end_cpu_access(const bool write) const noexcept {
+    if (dmabuf_fd < 0) {
+        return;
+    }
+    const auto direction {static_cast<uint64_t>(write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ)};
+    struct dma_buf_sync sync {DMA_BUF_SYNC_END | direction};
+    if (drmIoctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+        LOG_ERROR("failed to end CPU access to dma-buf: " << std::strerror(errno));
+    }
+}
+
+// NV12's interleaved chroma plane, at half resolution, starts straight after the luma plane. Other formats have none
+uint8_t* DRMFramebuffer::get_chroma() noexcept {
+    return pixel_format == DRM_FORMAT_NV12 ? buffer + size_t(info.pitch) * height : nullptr;
+}
 
-    plane.release();
+// Tells the driver which areas changed after drawing into a framebuffer that's being shown. Drivers which scan out a
+// copy of it, such as virtual GPUs and USB displays, only copy those areas; the rest don't implement this
+void DRMFramebuffer::mark_dirty(const std::vector<Rect>& rects) const {
+    std::vector<drmModeClip> clips;
+    for (const auto& rect: rects) {
+        const auto area {rect.intersect(get_bounds())};
+        if (!area.is_empty()) {
+            clips.push_back(drmModeClip{static_cast<uint16_t>(area.x), static_cast<uint16_t>(area.y),
+                static_cast<uint16_t>(area.x + area.w), static_cast<uint16_t>(area.y + area.h)});
+        }
+    }
+    if (clips.empty()) {
+        return;
+    }
+    if (drmModeDirtyFB(card.get_fd(), id, clips.data(), clips.size()) < 0 && errno != ENOSYS) {
+        throw DRMException{"failed to mark framebuffer dirty", errno};
+    }
 }
 
 void DRMFramebuffer::create_dumb_buffer() {
@@ -72,12 +212,17 @@ void DRMFramebuffer::create_dumb_buffer() {
 void DRMFramebuffer::add_framebuffer() {
     const auto fd {card.get_fd()};
 
-    const uint32_t handles[4] {info.handle, 0, 0, 0};
-    const uint32_t pitches[4] {info.pitch, 0, 0, 0};
-    const uint32_t offsets[4] {0, 0, 0, 0};
+    uint32_t handles[4] {info.handle, 0, 0, 0};
+    uint32_t pitches[4] {info.pitch, 0, 0, 0};
+    uint32_t offsets[4] {0, 0, 0, 0};
+    if (pixel_format == DRM_FORMAT_NV12) {
+        handles[1] = info.handle;
+        pitches[1] = info.pitch;
+        offsets[1] = info.pitch * height;
+    }
 
-    /* Add dumb buffer as framebuffer */
-    if (drmModeAddFB2(fd, info.width, info.height, pixel_format, handles, pitches, offsets, &id, 0) < 0) {
+    /* Add dumb buffer as framebuffer. The dumb buffer is taller than the image for NV12, but the framebuffer isn't */
+    if (drmModeAddFB2(fd, info.width, height, pixel_format, handles, pitches, offsets, &id, 0) < 0) {
         throw DRMException{"failed to create framebuffer", errno};
     }
 }
@@ -95,9 +240,34 @@ void DRMFramebuffer::map_dumb_buffer() {
     /* Map dumb buffer into process address space */
     buffer = static_cast<uint8_t*>(mmap(nullptr, info.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_buf.offset));
     if (buffer == MAP_FAILED) {
+        buffer = nullptr;
         throw DRMException{"failed to map dumb buffer", errno};
     }
 }
 
+void DRMFramebuffer::import_dmabuf(const int dmabuf_fd) {
+    if (!card.supports_prime_import()) {
+        throw DRMException{"dma-buf import not supported"};
+    }
+
+    if (drmPrimeFDToHandle(card.get_fd(), dmabuf_fd, &info.handle) < 0) {
+        throw DRMException{"failed to import dma-buf", errno};
+    }
+}
+
+void DRMFramebuffer::map_dmabuf(const int dmabuf_fd) {
+    /* dma-bufs are mapped through their own fd rather than the card's */
+    buffer = static_cast<uint8_t*>(mmap(nullptr, info.size, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0));
+    if (buffer == MAP_FAILED) {
+        buffer = nullptr;
+        throw DRMException{"failed to map dma-buf", errno};
+    }
+}
+
+bool DRMFramebuffer::close_handle() const noexcept {
+    struct drm_gem_close close_buf {info.handle, 0};
+    return drmIoctl(card.get_fd(), DRM_IOCTL_GEM_CLOSE, &close_buf) == 0;
+}
+
 
 }
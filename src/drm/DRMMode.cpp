@@ -0,0 +1,58 @@
+#include "drm.h"
+
+namespace drm {
+
+DRMMode::DRMMode(const drmModeModeInfo& info) noexcept : info{info} {}
+
+bool DRMMode::operator==(const DRMMode& other) const noexcept {
+    // Compare timings only: the name is informational and drivers may fill it in differently
+    const auto& a {info};
+    const auto& b {other.info};
+    return a.clock == b.clock &&
+        a.hdisplay == b.hdisplay && a.hsync_start == b.hsync_start && a.hsync_end == b.hsync_end &&
+        a.htotal == b.htotal && a.hskew == b.hskew &&
+        a.vdisplay == b.vdisplay && a.vsync_start == b.vsync_start && a.vsync_end == b.vsync_end &&
+        a.vtotal == b.vtotal && a.vscan == b.vscan &&
+        a.vrefresh == b.vrefresh && a.flags == b.flags;
+}
+
+// Order by preferred flag, then resolution, then refresh rate
+bool DRMMode::is_better_than(const DRMMode& other) const noexcept {
+    if (is_preferred() != other.is_preferred()) {
+        return is_preferred();
+    }
+    if (get_area() != other.get_area()) {
+        return get_area() > other.get_area();
+    }
+    return info.vrefresh > other.info.vrefresh;
+}
+
+// Time between vblanks, from the exact timings rather than the rounded vrefresh
+std::chrono::nanoseconds DRMMode::get_frame_interval() const noexcept {
+    const uint64_t pixels {uint64_t{info.htotal} * info.vtotal};
+    if (info.clock == 0 || pixels == 0) {
+        return std::chrono::nanoseconds{16666667};
+    }
+    // clock is in kHz
+    auto ns {pixels * 1000000 / info.clock};
+    if (info.flags & DRM_MODE_FLAG_INTERLACE) {
+        ns /= 2;
+    }
+    if (info.flags & DRM_MODE_FLAG_DBLSCAN) {
+        ns *= 2;
+    }
+    return std::chrono::nanoseconds{ns};
+}
+
+std::string DRMMode::to_string() const noexcept {
+    std::string s {"DRMMode{"};
+    s += std::to_string(info.hdisplay) + "x" + std::to_string(info.vdisplay);
+    s += "@" + std::to_string(info.vrefresh);
+    if (is_preferred()) {
+        s += ", preferred";
+    }
+    s += "}";
+    return s;
+}
+
+}
@@ -1,36 +1,38 @@
 #include "drm.h"
+#include "../trace/trace.h"
+#include <algorithm>
 #include <iostream>
+#include <drm_fourcc.h>
 
 namespace drm {
 
 DRMPlane::DRMPlane(DRMCard& card, const uint32_t id) noexcept : card{card}, id{id} {}
 
-void DRMPlane::repaint(const DRMCRTC& crtc, DRMFramebuffer& fb, const int32_t x, const int32_t y) {
-    try {
-        const auto crtc_id {crtc.get_id()};
-
-        const auto fb_id {fb.get_id()};
-        const auto fb_w {fb.get_width()};
-        const auto fb_h {fb.get_height()};
-        const auto src_w {fb_w << 16};
-        const auto src_h {fb_h << 16};
+// Shows fb on the plane. Normally this blocks until the change has taken effect; if flip_data is given and atomic
+// commits are available, it returns at once and a page-flip event carrying flip_data arrives on the card's fd when
+// the change takes effect. Returns whether an event is coming
+bool DRMPlane::repaint(const DRMCRTC& crtc, DRMFramebuffer& fb, const int32_t x, const int32_t y, void* flip_data) {
+    return repaint(crtc, fb, fb.get_bounds(), x, y, flip_data);
+}
 
+// Shows only the src area of fb, with its top-left corner at (x, y). Moving src around a framebuffer larger than the
+// area shown scrolls it without touching any pixels
+bool DRMPlane::repaint(const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src, const int32_t x, const int32_t y,
+        void* flip_data) {
+    TRACE_SCOPE("DRMPlane::repaint");
+    try {
         if (card.are_atomic_commits_enabled()) {
             const DRMAtomicRequest req {card};
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "FB_ID", fb_id);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", crtc_id);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_X", x);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", y);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_W", fb_w);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_H", fb_h);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_X", 0);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_W", src_w);
-            req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_H", src_h);
-
-            req.commit(/*DRM_MODE_ATOMIC_NONBLOCK*/);
+            add_to_request(req, crtc, fb, src, x, y);
+
+            if (flip_data) {
+                req.commit(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, flip_data);
+                return true;
+            }
+            req.commit();
         } else {
-            const auto res {drmModeSetPlane(card.get_fd(), id, crtc_id, fb_id, 0, x, y, fb_w, fb_h, 0, 0, src_w, src_h)};
+            const auto res {drmModeSetPlane(card.get_fd(), id, crtc.get_id(), fb.get_id(), 0, x, y, src.w, src.h,
+                src.x << 16, src.y << 16, src.w << 16, src.h << 16)};
             if (res == -EINVAL) {
                 throw DRMException{"invalid plane id or CRTC id"};
             } else if (res < 0) {
@@ -40,6 +42,107 @@ void DRMPlane::repaint(const DRMCRTC& crtc, DRMFramebuffer& fb, const int32_t x,
     } catch (const DRMException& e) {
         throw DRMException{"failed to repaint plane framebuffer", e};
     }
+    return false;
+}
+
+// Takes the plane off the screen, e.g. when what it showed is to be painted into the primary plane instead
+void DRMPlane::disable() {
+    TRACE_SCOPE("DRMPlane::disable");
+    try {
+        if (card.are_atomic_commits_enabled()) {
+            const DRMAtomicRequest req {card};
+            req.add_property(id, DRM_MODE_OBJECT_PLANE, "FB_ID", 0);
+            req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", 0);
+            req.commit();
+        } else if (drmModeSetPlane(card.get_fd(), id, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0) < 0) {
+            throw DRMException{errno};
+        }
+    } catch (const DRMException& e) {
+        throw DRMException{"failed to disable plane", e};
+    }
+}
+
+// Asks the driver whether it could show the src area of fb at (x, y), without changing anything. Drivers may reject
+// sizes, offsets or alignments the hardware can't scan out. Without atomic commits there's no way to ask, so the
+// answer is always yes
+bool DRMPlane::test(const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src, const int32_t x, const int32_t y) const {
+    TRACE_SCOPE("DRMPlane::test");
+    if (!card.are_atomic_commits_enabled()) {
+        return true;
+    }
+    const DRMAtomicRequest req {card};
+    add_to_request(req, crtc, fb, src, x, y);
+    return req.test();
+}
+
+// Adds the properties which show fb on the plane to req, for callers which need to change other objects in the same
+// commit
+void DRMPlane::add_to_request(const DRMAtomicRequest& req, const DRMCRTC& crtc, DRMFramebuffer& fb, const int32_t x,
+        const int32_t y) const {
+    add_to_request(req, crtc, fb, fb.get_bounds(), x, y);
+}
+
+void DRMPlane::add_to_request(const DRMAtomicRequest& req, const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src,
+        const int32_t x, const int32_t y) const {
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "FB_ID", fb.get_id());
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", crtc.get_id());
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_X", x);
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", y);
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_W", src.w);
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "CRTC_H", src.h);
+    // Source coordinates are 16.16 fixed point
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_X", uint64_t{static_cast<uint32_t>(src.x)} << 16);
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_Y", uint64_t{static_cast<uint32_t>(src.y)} << 16);
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_W", uint64_t{src.w} << 16);
+    req.add_property(id, DRM_MODE_OBJECT_PLANE, "SRC_H", uint64_t{src.h} << 16);
+    add_composition_to_request(req);
+}
+
+// Whether the plane can be combined with the others as described. Without atomic commits, only the defaults can be
+// shown
+bool DRMPlane::can_compose(const PlaneComposition& composition) const {
+    if (composition.is_default()) {
+        return true;
+    } else if (!card.are_atomic_commits_enabled()) {
+        return false;
+    }
+
+    const auto& props {get_composition_properties()};
+    return (composition.alpha == 0xFFFF || props.alpha) && (!composition.zpos || props.zpos) &&
+        (composition.blend_mode == PlaneBlendMode::PREMULTIPLIED ||
+            props.blend_modes[static_cast<size_t>(composition.blend_mode)]);
+}
+
+const DRMPlane::CompositionProperties& DRMPlane::get_composition_properties() const {
+    if (!composition_properties) {
+        const DRMProperties props {card, *this};
+        CompositionProperties found {};
+        found.alpha = props.is_settable("alpha");
+        found.zpos = props.is_settable("zpos");
+        found.blend_modes = {
+            props.get_enum_value("pixel blend mode", "Pre-multiplied"),
+            props.get_enum_value("pixel blend mode", "Coverage"),
+            props.get_enum_value("pixel blend mode", "None"),
+        };
+        composition_properties = found;
+    }
+    return *composition_properties;
+}
+
+// Every property the plane has is set, even to its default, so that nothing is left over from earlier commits.
+// Settings the plane lacks are left out; callers check can_compose() first
+void DRMPlane::add_composition_to_request(const DRMAtomicRequest& req) const {
+    const auto& props {get_composition_properties()};
+    if (props.alpha) {
+        req.add_property(id, DRM_MODE_OBJECT_PLANE, "alpha", composition.alpha);
+    }
+    if (props.zpos && composition.zpos) {
+        req.add_property(id, DRM_MODE_OBJECT_PLANE, "zpos", *composition.zpos);
+    }
+    const auto& blend_mode {props.blend_modes[static_cast<size_t>(composition.blend_mode)]};
+    if (blend_mode) {
+        req.add_property(id, DRM_MODE_OBJECT_PLANE, "pixel blend mode", *blend_mode);
+    }
 }
 
 DRMModePlaneUniquePtr DRMPlane::fetch_resource() const {
@@ -74,6 +177,28 @@ bool DRMPlane::is_compatible_with(const DRMCRTC& crtc) const {
     return (possible_crtcs & crtc_bit) != 0;
 }
 
+// Whether the plane can scan out linear buffers, such as dumb buffers, in format. IN_FORMATS lists the format and
+// modifier pairs a plane accepts; planes without it only list formats, which are taken to accept linear buffers
+bool DRMPlane::supports_format(const uint32_t format) const {
+    const DRMProperties props {card, *this};
+    if (props.has("IN_FORMATS")) {
+        const DRMModePropertyBlobUniquePtr blob {drmModeGetPropertyBlob(card.get_fd(), props["IN_FORMATS"]),
+            drmModeFreePropertyBlob};
+        if (blob) {
+            drmModeFormatModifierIterator iter {};
+            while (drmModeFormatModifierBlobIterNext(blob.get(), &iter)) {
+                if (iter.fmt == format && iter.mod == DRM_FORMAT_MOD_LINEAR) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    const auto plane {fetch_resource()};
+    return std::find(plane->formats, plane->formats + plane->count_formats, format) != plane->formats + plane->count_formats;
+}
+
 uint32_t DRMPlane::get_possible_crtcs() const {
     return fetch_resource()->possible_crtcs;
 }
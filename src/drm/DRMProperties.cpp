@@ -2,8 +2,15 @@
 
 namespace drm {
 
-DRMProperties::DRMProperties(const DRMCard& card, const DRMPlane& plane) : card{card},
-    props{drmModeObjectGetProperties(card.get_fd(), plane.get_id(), DRM_MODE_OBJECT_PLANE)} {}
+DRMProperties::DRMProperties(const DRMCard& card, const DRMPlane& plane) :
+    DRMProperties{card, plane.get_id(), DRM_MODE_OBJECT_PLANE} {}
+
+DRMProperties::DRMProperties(const DRMCard& card, const uint32_t obj_id, const uint32_t obj_type) : card{card},
+        props{drmModeObjectGetProperties(card.get_fd(), obj_id, obj_type)} {
+    if (!props) {
+        throw DRMException{"failed to get properties", errno};
+    }
+}
 
 DRMProperties::~DRMProperties() {
     drmModeFreeObjectProperties(props);
@@ -22,4 +29,38 @@ uint64_t DRMProperties::operator[](const std::string name) const {
     throw DRMException{"property " + name + " does not exist"};
 }
 
+bool DRMProperties::has(const std::string& name) const {
+    return find(name) != nullptr;
+}
+
+// Immutable properties (e.g. zpos on planes whose order is fixed) can be read but not set
+bool DRMProperties::is_settable(const std::string& name) const {
+    const auto prop {find(name)};
+    return prop && !(prop->flags & DRM_MODE_PROP_IMMUTABLE);
+}
+
+// Looks up the value which selects enum_name for an enum property, if the property exists and offers it
+std::optional<uint64_t> DRMProperties::get_enum_value(const std::string& name, const std::string& enum_name) const {
+    const auto prop {find(name)};
+    if (!prop || !(prop->flags & DRM_MODE_PROP_ENUM)) {
+        return std::nullopt;
+    }
+    for (int i {0}; i < prop->count_enums; i++) {
+        if (prop->enums[i].name == enum_name) {
+            return prop->enums[i].value;
+        }
+    }
+    return std::nullopt;
+}
+
+DRMModePropertyUniquePtr DRMProperties::find(const std::string& name) const {
+    for (uint32_t i {0}; i < props->count_props; i++) {
+        DRMModePropertyUniquePtr prop {drmModeGetProperty(card.get_fd(), props->props[i]), drmModeFreeProperty};
+        if (prop && prop->name == name) {
+            return prop;
+        }
+    }
+    return DRMModePropertyUniquePtr{nullptr, drmModeFreeProperty};
+}
+
 }
@@ -1,10 +1,14 @@
 #include "drm.h"
-#include <iostream>
+#include "../logging/logging.h"
 
 namespace drm {
 
-DRMPropertyBlob::DRMPropertyBlob(const DRMCard& card, const drmModeModeInfo* mode) : card{card} {
-    const auto res {drmModeCreatePropertyBlob(card.get_fd(), mode, sizeof(*mode), &id)};
+DRMPropertyBlob::DRMPropertyBlob(const DRMCard& card, const drmModeModeInfo* mode) :
+        DRMPropertyBlob{card, mode, sizeof(*mode)} {}
+
+// Blobs carry structured property values, such as colour LUTs and matrices
+DRMPropertyBlob::DRMPropertyBlob(const DRMCard& card, const void* data, const size_t size) : card{card} {
+    const auto res {drmModeCreatePropertyBlob(card.get_fd(), data, size, &id)};
     if (res == -1) {
         throw DRMException{"failed to create property blob: invalid data, size or id"};
     } else if (res == -ENOMEM) {
@@ -14,7 +18,7 @@ DRMPropertyBlob::DRMPropertyBlob(const DRMCard& card, const drmModeModeInfo* mod
 
 DRMPropertyBlob::~DRMPropertyBlob() {
     if (drmModeDestroyPropertyBlob(card.get_fd(), id) < 0) {
-        std::cerr << "failed to destroy property blob" << std::endl;
+        LOG_ERROR("failed to destroy property blob");
     }
 }
 
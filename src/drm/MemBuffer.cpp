@@ -9,7 +9,7 @@ MemBuffer::MemBuffer(const uint32_t width, const uint32_t height, const uint32_t
 }
 
 MemBuffer::~MemBuffer() {
-    delete buffer;
+    delete[] buffer;
 }
 
 uint8_t* MemBuffer::alloc() const {
@@ -0,0 +1,217 @@
+#include "drm.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace drm {
+
+// A row's extent within a shape, as [left, right] in pixel coordinates. Empty if left > right
+using RowExtent = std::pair<float, float>;
+
+static constexpr RowExtent empty_extent {1.0f, 0.0f};
+
+static int32_t to_pixel(const float v, const int32_t lo, const int32_t hi) noexcept {
+    // Clamp before converting, as shapes may extend arbitrarily far outside the buffer
+    return static_cast<int32_t>(std::clamp(v, static_cast<float>(lo), static_cast<float>(hi)));
+}
+
+// Solves lo <= a*x + b <= hi for x
+static RowExtent solve_linear(const float a, const float b, const float lo, const float hi) noexcept {
+    if (std::abs(a) < 1e-6f) {
+        const float inf {std::numeric_limits<float>::infinity()};
+        return (lo <= b && b <= hi) ? RowExtent{-inf, inf} : empty_extent;
+    }
+    const float x0 {(lo - b) / a};
+    const float x1 {(hi - b) / a};
+    return {std::min(x0, x1), std::max(x0, x1)};
+}
+
+static RowExtent unite(const RowExtent& a, const RowExtent& b) noexcept {
+    if (a.first > a.second) {
+        return b;
+    } else if (b.first > b.second) {
+        return a;
+    }
+    return {std::min(a.first, b.first), std::max(a.second, b.second)};
+}
+
+static RowExtent circle_extent(const float cx, const float cy, const float radius, const float yc) noexcept {
+    const float dy {yc - cy};
+    if (std::abs(dy) > radius) {
+        return empty_extent;
+    }
+    const float half {std::sqrt(radius*radius - dy*dy)};
+    return {cx - half, cx + half};
+}
+
+// Fills a convex shape. extent(yc, d) gives the row's extent at y = yc of the shape grown outwards by d (or shrunk, if
+// d is negative), and distance(x, y) gives the signed distance from the shape's edge, negative inside. Each pixel's
+// coverage is approximated as 0.5 - distance from its centre, which is exact for horizontal and vertical edges
+template <typename Extent, typename Distance>
+void Rasteriser::scan(const float top, const float bottom, const style::Colour c, const Extent& extent,
+        const Distance& distance) const noexcept {
+    const int32_t width {static_cast<int32_t>(target.get_width())};
+    const int32_t height {static_cast<int32_t>(target.get_height())};
+
+    // Without antialiasing, pixels are drawn if their centres are inside the shape
+    const float margin {antialias ? 0.5f : 0.0f};
+    const int32_t y_begin {to_pixel(std::floor(top - margin - 0.5f) + 1, 0, height)};
+    const int32_t y_end {to_pixel(std::ceil(bottom + margin - 0.5f) - 1, -1, height - 1)};
+
+    for (int32_t y {y_begin}; y <= y_end; y++) {
+        const float yc {y + 0.5f};
+
+        // Pixels with centres strictly inside the outer extent are at least partly covered
+        const auto [outer_l, outer_r] {extent(yc, margin)};
+        if (outer_l > outer_r) {
+            continue;
+        }
+        const int32_t x_begin {to_pixel(std::floor(outer_l - 0.5f) + 1, 0, width)};
+        const int32_t x_end {to_pixel(std::ceil(outer_r - 0.5f) - 1, -1, width - 1)};
+        if (x_begin > x_end) {
+            continue;
+        }
+
+        if (!antialias) {
+            target.blend_span(x_begin, y, x_end - x_begin + 1, c);
+            continue;
+        }
+
+        // Pixels with centres inside the inner extent are fully covered, so form a solid span
+        int32_t solid_begin {x_end + 1};
+        int32_t solid_end {x_end};
+        const auto [inner_l, inner_r] {extent(yc, -margin)};
+        if (inner_l <= inner_r) {
+            solid_begin = std::max(x_begin, to_pixel(std::ceil(inner_l - 0.5f), 0, width));
+            solid_end = std::min(x_end, to_pixel(std::floor(inner_r - 0.5f), -1, width - 1));
+            if (solid_begin > solid_end) {
+                solid_begin = x_end + 1;
+                solid_end = x_end;
+            }
+        }
+
+        const auto blend_edge = [&](const int32_t x) {
+            const float coverage {std::clamp(0.5f - distance(x + 0.5f, yc), 0.0f, 1.0f)};
+            if (coverage > 0.0f) {
+                target.blend_pixel(x, y, c, static_cast<uint8_t>(coverage * 0xFF + 0.5f));
+            }
+        };
+
+        for (int32_t x {x_begin}; x < solid_begin; x++) {
+            blend_edge(x);
+        }
+        if (solid_begin <= solid_end) {
+            target.blend_span(solid_begin, y, solid_end - solid_begin + 1, c);
+        }
+        for (int32_t x {std::max(solid_begin, solid_end + 1)}; x <= x_end; x++) {
+            blend_edge(x);
+        }
+    }
+}
+
+void Rasteriser::fill_rect(const float x, const float y, const float w, const float h, const style::Colour c) const noexcept {
+    fill_rounded_rect(x, y, w, h, 0.0f, c);
+}
+
+// Pixel-aligned rectangles need no coverage calculations at all
+void Rasteriser::fill_rect(const Rect& rect, const style::Colour c) const noexcept {
+    const auto clipped {rect.intersect(target.get_bounds())};
+    for (uint32_t i {0}; i < clipped.h; i++) {
+        target.blend_span(clipped.x, clipped.y + i, clipped.w, c);
+    }
+}
+
+// Draws a border of the given width inside rect
+void Rasteriser::stroke_rect(const Rect& rect, const uint32_t width, const style::Colour c) const noexcept {
+    const uint64_t both_sides {uint64_t{width} * 2}; // Can't wrap, unlike 2*width in 32 bits
+    if (both_sides >= rect.w || both_sides >= rect.h) {
+        fill_rect(rect, c);
+        return;
+    }
+
+    const int32_t w {static_cast<int32_t>(width)};
+    const uint32_t inner_h {rect.h - 2*width};
+    fill_rect(Rect{rect.x, rect.y, rect.w, width}, c);
+    fill_rect(Rect{rect.x, rect.y + static_cast<int32_t>(rect.h) - w, rect.w, width}, c);
+    fill_rect(Rect{rect.x, rect.y + w, width, inner_h}, c);
+    fill_rect(Rect{rect.x + static_cast<int32_t>(rect.w) - w, rect.y + w, width, inner_h}, c);
+}
+
+void Rasteriser::fill_rounded_rect(const float x, const float y, const float w, const float h, const float radius,
+        const style::Colour c) const noexcept {
+    if (w <= 0.0f || h <= 0.0f) {
+        return;
+    }
+    const float r {std::clamp(radius, 0.0f, std::min(w, h) / 2)};
+
+    // Growing or shrinking a rounded rectangle by d moves its edges by d and changes its corner radius by d
+    const auto extent = [=](const float yc, const float d) -> RowExtent {
+        const float top {y - d};
+        const float bottom {y + h + d};
+        if (yc < top || yc > bottom) {
+            return empty_extent;
+        }
+        const float rho {std::max(0.0f, r + d)};
+        const float dy {std::max({top + rho - yc, yc - (bottom - rho), 0.0f})};
+        const float inset {rho - std::sqrt(std::max(0.0f, rho*rho - dy*dy))};
+        return {x - d + inset, x + w + d - inset};
+    };
+
+    const float cx {x + w/2};
+    const float cy {y + h/2};
+    const float half_w {w/2 - r};
+    const float half_h {h/2 - r};
+    const auto distance = [=](const float px, const float py) {
+        const float qx {std::abs(px - cx) - half_w};
+        const float qy {std::abs(py - cy) - half_h};
+        return std::hypot(std::max(qx, 0.0f), std::max(qy, 0.0f)) + std::min(std::max(qx, qy), 0.0f) - r;
+    };
+
+    scan(y, y + h, c, extent, distance);
+}
+
+void Rasteriser::fill_circle(const float cx, const float cy, const float radius, const style::Colour c) const noexcept {
+    fill_rounded_rect(cx - radius, cy - radius, 2*radius, 2*radius, radius, c);
+}
+
+// Draws a line with round caps
+void Rasteriser::draw_line(const float x0, const float y0, const float x1, const float y1, const float width,
+        const style::Colour c) const noexcept {
+    const float half_width {width / 2};
+    if (half_width <= 0.0f) {
+        return;
+    }
+
+    const float dx {x1 - x0};
+    const float dy {y1 - y0};
+    const float length_sq {dx*dx + dy*dy};
+    const float length {std::sqrt(length_sq)};
+
+    // The row's extent is the union of the end caps' extents and the extent of the band along the line
+    const auto extent = [=](const float yc, const float d) -> RowExtent {
+        const float rho {half_width + d};
+        if (rho <= 0.0f) {
+            return empty_extent;
+        }
+
+        auto row {unite(circle_extent(x0, y0, rho, yc), circle_extent(x1, y1, rho, yc))};
+
+        if (length > 0.0f) {
+            // Projection along the line and distance across it are both linear in x along the row
+            const auto [tl, tr] {solve_linear(dx / length_sq, (-x0*dx + (yc - y0)*dy) / length_sq, 0.0f, 1.0f)};
+            const auto [nl, nr] {solve_linear(dy / length, (-x0*dy - (yc - y0)*dx) / length, -rho, rho)};
+            row = unite(row, RowExtent{std::max(tl, nl), std::min(tr, nr)});
+        }
+        return row;
+    };
+
+    const auto distance = [=](const float px, const float py) {
+        const float t {length_sq > 0.0f ? std::clamp(((px - x0)*dx + (py - y0)*dy) / length_sq, 0.0f, 1.0f) : 0.0f};
+        return std::hypot(px - (x0 + t*dx), py - (y0 + t*dy)) - half_width;
+    };
+
+    scan(std::min(y0, y1) - half_width, std::max(y0, y1) + half_width, c, extent, distance);
+}
+
+}
@@ -1,5 +1,6 @@
 #include "drm.h"
 #include "../gui/gui.h"
+#include "../trace/trace.h"
 #include <drm_fourcc.h>
 
 namespace drm {
@@ -21,10 +22,119 @@ std::array<std::unique_ptr<DRMFramebuffer>, 2> ScreenBitmap::make_buffers() cons
 }
 
 void ScreenBitmap::render() {
-    plane.repaint(crtc, *buffers[back], 0, 0);
+    present(nullptr);
 
     // TODO: do this here or in a separate refresh function?
     back ^= 1;
+    if (cursor) {
+        cursor->erase_from(back);
+    }
+}
+
+// Like render(), but doesn't wait for the next vblank. The DisplayManager's event loop calls page_flip_complete()
+// when the flip happens; until then the new back buffer is still on screen and mustn't be drawn into. Returns false
+// if the buffer had to be shown synchronously instead (without atomic commits)
+bool ScreenBitmap::flip() {
+    if (flip_pending) {
+        throw DRMException{"cannot flip: a page flip is already pending"};
+    }
+
+    flip_pending = present(static_cast<FlipListener*>(this));
+    back ^= 1;
+    if (flip_pending) {
+        gui::DisplayManager::the().flip_queued(*this);
+    }
+    return flip_pending;
+}
+
+// The framebuffer which was being shown is handed back for drawing, without the software cursor
+void ScreenBitmap::page_flip_complete() noexcept {
+    flip_pending = false;
+    if (cursor) {
+        cursor->erase_from(back);
+    }
+}
+
+// Copies the shadow into the framebuffer and hands the frame to the capture, if there is one, then shows it. Returns
+// whether a page-flip event is coming
+bool ScreenBitmap::present(FlipListener* flip_listener) {
+    TRACE_SCOPE("ScreenBitmap::present");
+    // TODO: only copy the areas which have changed
+    if (colour_transform) {
+        colour_transform->apply(*shadows[back], *buffers[back]);
+    } else if (shadows[back]) {
+        shadows[back]->paint(*buffers[back], 0, 0, false);
+    }
+    if (cursor && cursor->is_software()) {
+        cursor->draw_into(back); // After the shadow copy, so the shadow never holds the cursor
+    }
+    if (capture && !capture->is_using_writeback()) {
+        capture->frame_presented(*get_back_buffer());
+    }
+
+    auto& card {gui::DisplayManager::the().get_drm_card()};
+    const bool writeback {capture && capture->is_using_writeback()};
+    if (!writeback && !(cursor && card.are_atomic_commits_enabled())) {
+        return plane.repaint(crtc, *buffers[back], 0, 0, flip_listener);
+    }
+
+    // A writeback job or a cursor move rides on the commit which shows the frame, so needs no commit of its own
+    const DRMAtomicRequest req {card};
+    plane.add_to_request(req, crtc, *buffers[back], 0, 0);
+    const bool capturing {writeback && capture->add_to_request(req)};
+    const bool moving_cursor {cursor && cursor->add_to_request(req)};
+    try {
+        if (flip_listener) {
+            req.commit(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, flip_listener);
+        } else {
+            req.commit();
+        }
+    } catch (const DRMException& e) {
+        if (capturing) {
+            capture->commit_failed();
+        }
+        throw DRMException{"failed to repaint plane framebuffer", e};
+    }
+    if (capturing) {
+        capture->committed();
+    }
+    if (moving_cursor) {
+        cursor->committed();
+    }
+    return flip_listener != nullptr;
+}
+
+// The shadows start out with the framebuffers' contents, so nothing already drawn is lost
+void ScreenBitmap::enable_shadow() {
+    if (shadows[0]) {
+        return;
+    }
+    for (auto i {0}; i < 2; i++) {
+        shadows[i] = std::make_unique<MemBuffer>(buffers[i]->get_width(), buffers[i]->get_height(), 32);
+        static_cast<const Buffer&>(*buffers[i]).paint(*shadows[i], 0, 0, false);
+    }
+}
+
+// Drawing goes straight to the framebuffers again, unless a capture or a software colour transform still needs the
+// shadow. The front framebuffer already holds the last frame presented; the back shadow may hold a frame being drawn
+void ScreenBitmap::disable_shadow() {
+    if (!shadows[0] || capture || colour_transform) {
+        return;
+    }
+    shadows[back]->paint(*buffers[back], 0, 0, false);
+    shadows = {};
+}
+
+// Uses the CRTC's colour pipeline where it has one. Otherwise the screen is switched to a shadow, and the correction is
+// applied in software as each frame is copied out of it
+void ScreenBitmap::set_colour_correction(const ColourCorrection& correction) {
+    if (crtc.set_colour_correction(correction) || correction.is_identity()) {
+        colour_transform.reset();
+        disable_shadow();
+        return;
+    }
+    enable_shadow();
+    colour_transform = std::make_unique<ColourTransform>(correction);
 }
 
 }
@@ -0,0 +1,252 @@
+#include "drm.h"
+#include "../gui/gui.h"
+#include "../logging/logging.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <drm_fourcc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace drm {
+
+ScreenCapture::ScreenCapture(ScreenBitmap& screen, const int out_fd, const uint32_t ring_size) :
+        screen{screen}, card{gui::DisplayManager::the().get_drm_card()}, out_fd{out_fd},
+        writeback_connector{select_connector()}, slots{make_slots(ring_size)} {
+    if (is_using_writeback()) {
+        attach_connector(screen.get_crtc().get_id());
+    } else {
+        screen.enable_shadow();
+    }
+    screen.set_capture(this);
+    writer = std::thread{&ScreenCapture::write_frames, this};
+}
+
+// The hardware may still be writing frames into the slots, so their fences are waited on, and the connector detached
+// with a blocking commit (which completes any writeback job left), before the buffers are freed
+ScreenCapture::~ScreenCapture() {
+    screen.set_capture(nullptr);
+
+    for (size_t i {0}; i < slots.size(); i++) {
+        if (slots[i].fence < 0) {
+            continue;
+        }
+        pollfd fence {slots[i].fence, POLLIN, 0};
+        if (poll(&fence, 1, fence_timeout_ms) > 0) {
+            fence_signalled(i); // Queued, so the frame is still written out
+        } else {
+            LOG_WARNING("writeback fence didn't signal in " << fence_timeout_ms << "ms");
+        }
+    }
+
+    if (is_using_writeback()) {
+        try {
+            attach_connector(0);
+        } catch (const DRMException& e) {
+            LOG_ERROR("failed to detach writeback connector: " << e.what());
+        }
+    } else {
+        screen.disable_shadow();
+    }
+
+    {
+        const std::lock_guard<std::mutex> lock {mutex};
+        stopping = true;
+    }
+    queued.notify_one();
+    writer.join();
+
+    auto& dm {gui::DisplayManager::the()};
+    for (auto& slot: slots) {
+        if (slot.fence >= 0) {
+            dm.remove_fd(slot.watch_id);
+            close(slot.fence);
+        }
+    }
+}
+
+uint32_t ScreenCapture::select_connector() {
+    if (!card.enable_writeback_connectors()) {
+        return 0;
+    }
+    return card.find_writeback_connector(screen.get_crtc());
+}
+
+std::vector<ScreenCapture::Slot> ScreenCapture::make_slots(const uint32_t ring_size) {
+    const auto w {screen.get_crtc().get_width()};
+    const auto h {screen.get_crtc().get_height()};
+
+    std::vector<Slot> slots(std::max<uint32_t>(ring_size, 1));
+    for (auto& slot: slots) {
+        if (writeback_connector) {
+            slot.buffer = std::make_unique<DRMFramebuffer>(card, w, h, 32, DRM_FORMAT_XRGB8888);
+        } else {
+            slot.buffer = std::make_unique<MemBuffer>(w, h, 32);
+        }
+    }
+    return slots;
+}
+
+// Routing a connector to a CRTC is a modeset, so this is done once, up front, rather than in every capturing commit
+void ScreenCapture::attach_connector(const uint32_t crtc_id) const {
+    const DRMAtomicRequest req {card};
+    req.add_property(writeback_connector, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", crtc_id);
+    req.commit(DRM_MODE_ATOMIC_ALLOW_MODESET);
+}
+
+// Adds a writeback job for the frame being committed. Returns false, dropping the frame, if every buffer is in use
+bool ScreenCapture::add_to_request(const DRMAtomicRequest& req) {
+    const auto index {acquire_slot()};
+    if (index < 0) {
+        return false;
+    }
+
+    auto& slot {slots[index]};
+    const auto& fb {static_cast<const DRMFramebuffer&>(*slot.buffer)};
+    slot.fence = -1;
+    try {
+        req.add_property(writeback_connector, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_FB_ID", fb.get_id());
+        req.add_property(writeback_connector, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_OUT_FENCE_PTR",
+            reinterpret_cast<uint64_t>(&slot.fence));
+    } catch (...) {
+        const std::lock_guard<std::mutex> lock {mutex};
+        slot.state = SlotState::FREE;
+        throw;
+    }
+    pending_slot = index;
+    return true;
+}
+
+// The out-fence is readable once the hardware has finished writing the frame
+void ScreenCapture::committed() {
+    const auto index {pending_slot};
+    pending_slot = -1;
+    auto& slot {slots[index]};
+
+    if (slot.fence < 0) {
+        commit_failed();
+        return;
+    }
+    try {
+        slot.watch_id = gui::DisplayManager::the().add_fd(slot.fence, EPOLLIN, gui::EventPriority::DISPLAY,
+            [this, index](const uint32_t) { fence_signalled(index); });
+    } catch (const gui::GUIException& e) {
+        LOG_ERROR("failed to watch writeback fence: " << e.what());
+        close(slot.fence);
+        slot.fence = -1;
+        const std::lock_guard<std::mutex> lock {mutex};
+        slot.state = SlotState::FREE;
+        frames_dropped++;
+    }
+}
+
+void ScreenCapture::commit_failed() noexcept {
+    if (pending_slot < 0) {
+        return;
+    }
+    const std::lock_guard<std::mutex> lock {mutex};
+    slots[pending_slot].state = SlotState::FREE;
+    pending_slot = -1;
+    frames_dropped++;
+}
+
+// Without writeback, the frame is copied from the screen's shadow, which is ordinary cached memory
+void ScreenCapture::frame_presented(const Buffer& frame) {
+    const auto index {acquire_slot()};
+    if (index < 0) {
+        return;
+    }
+    frame.paint(*slots[index].buffer, 0, 0, false);
+    queue_slot(index);
+}
+
+int ScreenCapture::acquire_slot() {
+    const std::lock_guard<std::mutex> lock {mutex};
+    for (size_t i {0}; i < slots.size(); i++) {
+        if (slots[i].state == SlotState::FREE) {
+            slots[i].state = SlotState::CAPTURING;
+            return i;
+        }
+    }
+    frames_dropped++;
+    return -1;
+}
+
+void ScreenCapture::queue_slot(const int index) {
+    {
+        const std::lock_guard<std::mutex> lock {mutex};
+        slots[index].state = SlotState::QUEUED;
+        queue.push_back(index);
+    }
+    queued.notify_one();
+}
+
+void ScreenCapture::fence_signalled(const int index) {
+    auto& slot {slots[index]};
+    gui::DisplayManager::the().remove_fd(slot.watch_id);
+    close(slot.fence);
+    slot.fence = -1;
+    queue_slot(index);
+}
+
+// Runs on the writer thread. Slots are only touched here while they are queued, so the buffers need no locking
+void ScreenCapture::write_frames() {
+    // A reader closing the pipe should show up as EPIPE here rather than killing the process
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    bool failed {false};
+    std::unique_lock<std::mutex> lock {mutex};
+    while (true) {
+        queued.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return; // Frames already captured are written out before stopping
+        }
+
+        const auto index {queue.front()};
+        queue.pop_front();
+        lock.unlock();
+
+        if (!failed && !write_frame(*slots[index].buffer)) {
+            LOG_ERROR("stopping screen capture: " << std::strerror(errno));
+            failed = true;
+        }
+
+        lock.lock();
+        slots[index].state = SlotState::FREE;
+        (failed ? frames_dropped : frames_written)++;
+    }
+}
+
+bool ScreenCapture::write_frame(const Buffer& frame) const {
+    const auto row_size {frame.get_width() * 4};
+    const auto stride {frame.get_stride()};
+    const auto height {frame.get_height()};
+    const auto data {frame.get_buffer()};
+
+    // Rows are written in one go when there's no padding between them
+    const size_t run {stride == row_size ? size_t{row_size} * height : row_size};
+    const size_t runs {stride == row_size ? 1 : height};
+    for (size_t i {0}; i < runs; i++) {
+        const uint8_t* p {data + i * stride};
+        size_t left {run};
+        while (left > 0) {
+            const auto n {write(out_fd, p, left)};
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,56 @@
+#include "drm.h"
+#include <cmath>
+
+namespace drm {
+
+ShadowCache& ShadowCache::the() {
+    static ShadowCache instance {};
+    return instance;
+}
+
+// Three standard deviations take in all but a sliver of the blur
+uint32_t ShadowCache::get_padding(const float sigma) noexcept {
+    return sigma > 0.0f ? static_cast<uint32_t>(std::ceil(3 * sigma)) : 0;
+}
+
+std::string ShadowCache::make_key(const uint32_t w, const uint32_t h, const float corner_radius, const float sigma,
+        const style::Colour c) {
+    return std::to_string(w) + "x" + std::to_string(h) + ":" + std::to_string(corner_radius) + ":" +
+        std::to_string(sigma) + ":" + std::to_string(c.to_int());
+}
+
+// Returns the shadow of a w x h rounded rectangle, making it if it isn't cached
+std::shared_ptr<const MemBuffer> ShadowCache::get(const uint32_t w, const uint32_t h, const float corner_radius,
+        const float sigma, const style::Colour c) {
+    const auto key {make_key(w, h, corner_radius, sigma, c)};
+    if (auto shadow {cache.find(key)}) {
+        return shadow;
+    }
+
+    const auto padding {get_padding(sigma)};
+    auto shadow {std::make_shared<MemBuffer>(w + 2*padding, h + 2*padding, 32)};
+    shadow->fill(style::Colour::clear());
+    Rasteriser{*shadow}.fill_rounded_rect(padding, padding, w, h, corner_radius, c);
+    shadow->gaussian_blur(shadow->get_bounds(), sigma);
+
+    cache.insert(key, shadow);
+    return shadow;
+}
+
+// Makes the shadow of any shape, from its alpha channel alone. Nothing is cached, so callers should keep the result
+// for as long as the shape stays the same
+std::unique_ptr<MemBuffer> ShadowCache::make_shadow(const Buffer& shape, const float sigma, const style::Colour c) {
+    const auto padding {get_padding(sigma)};
+    auto shadow {std::make_unique<MemBuffer>(shape.get_width() + 2*padding, shape.get_height() + 2*padding, 32)};
+    shadow->fill(style::Colour::clear());
+
+    // The colour is cut to the shape's silhouette with DST_IN, which scales it by the shape's alpha
+    const auto inner {shape.get_bounds().translate(padding, padding)};
+    shadow->fill(c, inner);
+    shape.paint(*shadow, padding, padding, style::BlendOperator::DST_IN);
+
+    shadow->gaussian_blur(shadow->get_bounds(), sigma);
+    return shadow;
+}
+
+}
@@ -0,0 +1,96 @@
+#include "drm.h"
+#include "../logging/logging.h"
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace drm {
+
+// Allocates a new shareable buffer, for use by a display server client
+SharedMemBuffer::SharedMemBuffer(const uint32_t width, const uint32_t height) :
+        width{width}, height{height}, stride{make_stride(width, height)}, fd{create_memfd()} {
+    try {
+        map();
+    } catch (const DRMException& e) {
+        close(fd);
+        throw e;
+    }
+}
+
+// Maps a buffer received from another process, taking ownership of fd
+SharedMemBuffer::SharedMemBuffer(const int fd, const uint32_t width, const uint32_t height, const uint32_t stride) :
+        width{width}, height{height}, stride{stride}, fd{fd} {
+    try {
+        if (!is_valid_layout(width, height, stride)) {
+            throw DRMException{"invalid shared buffer layout"};
+        }
+        check_memfd();
+        map();
+    } catch (const DRMException& e) {
+        close(fd);
+        throw e;
+    }
+}
+
+// Each row must hold the width, and the whole buffer must be addressable with 32-bit offsets. Everything is checked in
+// 64 bits, so a huge height can't wrap the size round to something small which then passes the fd size check
+bool SharedMemBuffer::is_valid_layout(const uint32_t width, const uint32_t height, const uint64_t stride) noexcept {
+    return stride <= UINT32_MAX && uint64_t{width} * 4 <= stride && stride * height <= UINT32_MAX;
+}
+
+uint32_t SharedMemBuffer::make_stride(const uint32_t width, const uint32_t height) {
+    if (!is_valid_layout(width, height, uint64_t{width} * 4)) {
+        throw DRMException{"shared buffer is too big"};
+    }
+    return width * 4;
+}
+
+SharedMemBuffer::~SharedMemBuffer() {
+    if (munmap(buffer, size_t{stride} * height) < 0) {
+        LOG_ERROR("failed to unmap shared buffer");
+    }
+    close(fd);
+}
+
+int SharedMemBuffer::create_memfd() const {
+    const auto fd {memfd_create("display-surface", MFD_CLOEXEC | MFD_ALLOW_SEALING)};
+    if (fd < 0) {
+        throw DRMException{"failed to create memfd", errno};
+    }
+
+    // Sealing against shrinking means the receiver can't be made to fault by truncating the file under it
+    if (ftruncate(fd, off_t(size_t{stride} * height)) < 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0) {
+        const auto err {errno};
+        close(fd);
+        throw DRMException{"failed to size memfd", err};
+    }
+    return fd;
+}
+
+// A buffer from another process must be big enough and must not be able to shrink while it is mapped
+void SharedMemBuffer::check_memfd() const {
+    const auto seals {fcntl(fd, F_GET_SEALS)};
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0) {
+        throw DRMException{"shared buffer is not sealed against shrinking"};
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        throw DRMException{"failed to stat shared buffer", errno};
+    }
+    if (static_cast<uint64_t>(st.st_size) < static_cast<uint64_t>(stride) * height) {
+        throw DRMException{"shared buffer is too small"};
+    }
+}
+
+void SharedMemBuffer::map() {
+    buffer = static_cast<uint8_t*>(mmap(nullptr, size_t{stride} * height, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if (buffer == MAP_FAILED) {
+        buffer = nullptr;
+        throw DRMException{"failed to map shared buffer", errno};
+    }
+}
+
+}
@@ -0,0 +1,227 @@
+#include "drm.h"
+#include "../gui/gui.h"
+#include "../logging/logging.h"
+#include "../trace/trace.h"
+#include <algorithm>
+#include <cmath>
+#include <drm_fourcc.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace drm {
+
+VideoSurface::VideoSurface(const uint32_t width, const uint32_t height, const uint32_t format,
+        const YUVEncoding encoding, const bool full_range) :
+        width{width}, height{height}, format{format}, encoding{encoding}, full_range{full_range},
+        plane{claim_plane()}, framebuffers{make_framebuffers()}, frames{make_frames()} {}
+
+// Looks for an overlay plane which takes the format as it is. Not finding one isn't an error: frames are converted
+DRMPlane* VideoSurface::claim_plane() const noexcept {
+    if (format != DRM_FORMAT_NV12 && format != DRM_FORMAT_YUYV) {
+        LOG_ERROR("unsupported video format " << format);
+        return nullptr;
+    }
+    try {
+        auto& crtc {gui::DisplayManager::the().get_drm_card().get_connected_crtc()}; // TODO: select "primary" crtc?
+        return &crtc.claim_unused_overlay_plane(format);
+    } catch (const DRMException& e) {
+        LOG_WARNING(e.what() << " (converting video in software)");
+        return nullptr;
+    }
+}
+
+// If the driver won't make framebuffers of the format after all, the plane is given back and frames are converted
+std::array<std::unique_ptr<DRMFramebuffer>, 2> VideoSurface::make_framebuffers() {
+    if (!plane) {
+        return {};
+    }
+
+    auto& card {gui::DisplayManager::the().get_drm_card()};
+    const uint32_t bpp {format == DRM_FORMAT_NV12 ? 8u : 16u};
+    try {
+        return std::array<std::unique_ptr<DRMFramebuffer>, 2>{
+            std::make_unique<DRMFramebuffer>(card, *plane, width, height, bpp, format),
+            std::make_unique<DRMFramebuffer>(card, *plane, width, height, bpp, format),
+        };
+    } catch (const DRMException& e) {
+        LOG_WARNING(e.what() << " (converting video in software)");
+        plane->release();
+        plane = nullptr;
+        return {};
+    }
+}
+
+std::array<std::vector<uint8_t>, 2> VideoSurface::make_frames() const {
+    if (plane) {
+        return {};
+    }
+
+    // NV12 is 12 bits per pixel and YUYV 16
+    const size_t size {format == DRM_FORMAT_NV12 ? size_t{width} * height * 3 / 2 : size_t{width} * height * 2};
+    return {std::vector<uint8_t>(size), std::vector<uint8_t>(size)};
+}
+
+// The frame to write the next picture into. It's shown by the next call to render()
+VideoSurface::Frame VideoSurface::get_back_frame() noexcept {
+    if (plane) {
+        auto& fb {*framebuffers[back]};
+        return Frame{{fb.get_buffer(), fb.get_chroma()}, {fb.get_stride(), fb.get_stride()}};
+    }
+
+    uint8_t* data {frames[back].data()};
+    if (format == DRM_FORMAT_NV12) {
+        return Frame{{data, data + size_t{width} * height}, {width, width}};
+    }
+    return Frame{{data, nullptr}, {width * 2, 0}};
+}
+
+// Shows the back frame with its top-left corner at (x, y), then swaps frames
+void VideoSurface::render(ScreenBitmap& target, const int32_t x, const int32_t y) {
+    TRACE_SCOPE("VideoSurface::render");
+    if (plane) {
+        auto& card {gui::DisplayManager::the().get_drm_card()};
+        const DRMCRTC& crtc {target.get_crtc()};
+        auto& fb {*framebuffers[back]};
+        if (card.are_atomic_commits_enabled()) {
+            const DRMAtomicRequest req {card};
+            plane->add_to_request(req, crtc, fb, x, y);
+            add_colour_properties(req);
+            req.commit();
+        } else {
+            plane->repaint(crtc, fb, x, y);
+        }
+    } else {
+        convert(get_back_frame(), format, width, height, encoding, full_range, *target.get_back_buffer(), x, y);
+    }
+    back ^= 1;
+}
+
+// Tells the plane which matrix and range to convert with, if it lets them be chosen
+void VideoSurface::add_colour_properties(const DRMAtomicRequest& req) const {
+    const DRMProperties props {gui::DisplayManager::the().get_drm_card(), *plane};
+    const auto encoding_value {props.get_enum_value("COLOR_ENCODING",
+        encoding == YUVEncoding::BT601 ? "ITU-R BT.601 YCbCr" : "ITU-R BT.709 YCbCr")};
+    if (encoding_value) {
+        req.add_property(plane->get_id(), DRM_MODE_OBJECT_PLANE, "COLOR_ENCODING", *encoding_value);
+    }
+    const auto range_value {props.get_enum_value("COLOR_RANGE",
+        full_range ? "YCbCr full range" : "YCbCr limited range")};
+    if (range_value) {
+        req.add_property(plane->get_id(), DRM_MODE_OBJECT_PLANE, "COLOR_RANGE", *range_value);
+    }
+}
+
+// Conversion coefficients in Q6 fixed point, so that every intermediate fits a signed 16-bit lane
+struct YUVCoefficients {
+    int16_t y, y_offset, rv, gu, gv, bu;
+};
+
+static YUVCoefficients make_coefficients(const YUVEncoding encoding, const bool full_range) noexcept {
+    const float kr {encoding == YUVEncoding::BT601 ? 0.299f : 0.2126f};
+    const float kb {encoding == YUVEncoding::BT601 ? 0.114f : 0.0722f};
+    const float kg {1.0f - kr - kb};
+    // Limited range puts luma in 16-235 and chroma in 16-240
+    const float y_scale {full_range ? 1.0f : 255.0f / 219.0f};
+    const float c_scale {full_range ? 1.0f : 255.0f / 224.0f};
+    const auto q6 {[](const float v) { return static_cast<int16_t>(std::lround(v * 64)); }};
+    return YUVCoefficients{q6(y_scale), static_cast<int16_t>(full_range ? 0 : 16), q6(2 * (1 - kr) * c_scale),
+        q6(2 * kb * (1 - kb) / kg * c_scale), q6(2 * kr * (1 - kr) / kg * c_scale), q6(2 * (1 - kb) * c_scale)};
+}
+
+static uint32_t yuv_to_argb(const int32_t y, const int32_t u, const int32_t v, const YUVCoefficients& k) noexcept {
+    const int32_t luma {(y - k.y_offset) * k.y + 32};
+    const int32_t r {std::clamp((luma + k.rv * (v - 128)) >> 6, 0, 0xFF)};
+    const int32_t g {std::clamp((luma - k.gu * (u - 128) - k.gv * (v - 128)) >> 6, 0, 0xFF)};
+    const int32_t b {std::clamp((luma + k.bu * (u - 128)) >> 6, 0, 0xFF)};
+    return 0xFF000000 | r << 16 | g << 8 | b;
+}
+
+// Converts n pixels of a row, starting at pixel src_x. luma and chroma are the row's planes; YUYV has only the first
+template<uint32_t Format>
+static void convert_row(const uint8_t* luma, const uint8_t* chroma, const uint32_t src_x, uint32_t* out,
+        const uint32_t n, const YUVCoefficients& k) noexcept {
+    const auto pixel {[luma, chroma, &k](const uint32_t x) {
+        if constexpr (Format == DRM_FORMAT_NV12) {
+            return yuv_to_argb(luma[x], chroma[x & ~1u], chroma[x | 1u], k);
+        } else {
+            return yuv_to_argb(luma[x * 2], luma[(x & ~1u) * 2 + 1], luma[(x & ~1u) * 2 + 3], k);
+        }
+    }};
+
+    uint32_t i {0};
+    // Pixels pair up with their chroma sample from an even x
+    if (src_x % 2 && n > 0) {
+        out[i] = pixel(src_x + i);
+        i++;
+    }
+#ifdef __SSE2__
+    const __m128i zero {_mm_setzero_si128()};
+    const __m128i y_offset {_mm_set1_epi16(k.y_offset)}, y_coef {_mm_set1_epi16(k.y)}, half {_mm_set1_epi16(32)};
+    const __m128i rv {_mm_set1_epi16(k.rv)}, gu {_mm_set1_epi16(k.gu)}, gv {_mm_set1_epi16(k.gv)};
+    const __m128i bu {_mm_set1_epi16(k.bu)}, bias {_mm_set1_epi16(128)}, low {_mm_set1_epi32(0xFFFF)};
+    const __m128i alpha {_mm_set1_epi8(-1)};
+    for (; i + 8 <= n; i += 8) {
+        const uint32_t x {src_x + i};
+        __m128i y, uv; // Eight luma samples, and the four chroma pairs they share, as 16-bit lanes
+        if constexpr (Format == DRM_FORMAT_NV12) {
+            y = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(luma + x)), zero);
+            uv = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(chroma + x)), zero);
+        } else {
+            const __m128i packed {_mm_loadu_si128(reinterpret_cast<const __m128i*>(luma + x * 2))};
+            y = _mm_and_si128(packed, _mm_set1_epi16(0xFF));
+            uv = _mm_srli_epi16(packed, 8);
+        }
+
+        // Spread each chroma sample over the two pixels it covers
+        __m128i u {_mm_and_si128(uv, low)};
+        __m128i v {_mm_srli_epi32(uv, 16)};
+        u = _mm_sub_epi16(_mm_or_si128(u, _mm_slli_epi32(u, 16)), bias);
+        v = _mm_sub_epi16(_mm_or_si128(v, _mm_slli_epi32(v, 16)), bias);
+
+        // Sums only saturate when the result is out of range anyway
+        const __m128i l {_mm_adds_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, y_offset), y_coef), half)};
+        const __m128i r {_mm_srai_epi16(_mm_adds_epi16(l, _mm_mullo_epi16(v, rv)), 6)};
+        const __m128i g {_mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(l, _mm_mullo_epi16(u, gu)),
+            _mm_mullo_epi16(v, gv)), 6)};
+        const __m128i b {_mm_srai_epi16(_mm_adds_epi16(l, _mm_mullo_epi16(u, bu)), 6)};
+
+        // Interleave into B, G, R, A bytes
+        const __m128i bg {_mm_unpacklo_epi8(_mm_packus_epi16(b, zero), _mm_packus_epi16(g, zero))};
+        const __m128i ra {_mm_unpacklo_epi8(_mm_packus_epi16(r, zero), alpha)};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = pixel(src_x + i);
+    }
+}
+
+// Converts a whole frame to opaque ARGB, with its top-left corner at (x, y) in dst
+void VideoSurface::convert(const Frame& frame, const uint32_t format, const uint32_t width, const uint32_t height,
+        const YUVEncoding encoding, const bool full_range, Buffer& dst, const int32_t x, const int32_t y) noexcept {
+    TRACE_SCOPE("VideoSurface::convert");
+    const Rect placed {x, y, width, height};
+    const auto dst_area {placed.intersect(dst.get_bounds())};
+    if (dst_area.is_empty()) {
+        return;
+    }
+
+    const auto k {make_coefficients(encoding, full_range)};
+    const uint32_t src_x {static_cast<uint32_t>(dst_area.x - x)};
+    const uint32_t src_y {static_cast<uint32_t>(dst_area.y - y)};
+    for (uint32_t i {0}; i < dst_area.h; i++) {
+        const uint32_t row {src_y + i};
+        uint32_t* out {reinterpret_cast<uint32_t*>(dst.get_buffer() + size_t(dst_area.y + i)*dst.get_stride()) + dst_area.x};
+        const uint8_t* luma {frame.data[0] + size_t(row)*frame.strides[0]};
+        if (format == DRM_FORMAT_NV12) {
+            const uint8_t* chroma {frame.data[1] + size_t(row / 2)*frame.strides[1]};
+            convert_row<DRM_FORMAT_NV12>(luma, chroma, src_x, out, dst_area.w, k);
+        } else {
+            convert_row<DRM_FORMAT_YUYV>(luma, nullptr, src_x, out, dst_area.w, k);
+        }
+    }
+}
+
+}
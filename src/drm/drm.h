@@ -1,11 +1,20 @@
+#include "../cache/cache.h"
 #include "../style/style.h"
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -27,6 +36,8 @@ using DRMModeCRTCDel = decltype(&drmModeFreeCrtc);
 using DRMModeEncoderDel = decltype(&drmModeFreeEncoder);
 using DRMModePlaneResDel = decltype(&drmModeFreePlaneResources);
 using DRMModePlaneDel = decltype(&drmModeFreePlane);
+using DRMModePropertyDel = decltype(&drmModeFreeProperty);
+using DRMModePropertyBlobDel = decltype(&drmModeFreePropertyBlob);
 
 using DRMModeResUniquePtr = std::unique_ptr<drmModeRes, DRMModeResDel>;
 using DRMModeConnUniquePtr = std::unique_ptr<drmModeConnector, DRMModeConnDel>;
@@ -34,35 +45,123 @@ using DRMModeCRTCUniquePtr = std::unique_ptr<drmModeCrtc, DRMModeCRTCDel>;
 using DRMModeEncoderUniquePtr = std::unique_ptr<drmModeEncoder, DRMModeEncoderDel>;
 using DRMModePlaneResUniquePtr = std::unique_ptr<drmModePlaneRes, DRMModePlaneResDel>;
 using DRMModePlaneUniquePtr = std::unique_ptr<drmModePlane, DRMModePlaneDel>;
+using DRMModePropertyUniquePtr = std::unique_ptr<drmModePropertyRes, DRMModePropertyDel>;
+using DRMModePropertyBlobUniquePtr = std::unique_ptr<drmModePropertyBlobRes, DRMModePropertyBlobDel>;
 
 enum class BufferType {
     MEMORY, DRM_PRIMARY, DRM_CURSOR, DRM_OVERLAY
 };
 
+// How a plane's pixels are blended with what lies beneath it, as in the "pixel blend mode" plane property. COVERAGE
+// treats the pixels as straight rather than premultiplied alpha, and NONE ignores their alpha
+enum class PlaneBlendMode {
+    PREMULTIPLIED, COVERAGE, NONE
+};
+
+// Rect is an axis-aligned rectangle of pixels, e.g. a damaged region of a buffer
+struct Rect {
+    int32_t x {0}, y {0};
+    uint32_t w {0}, h {0};
+
+    bool is_empty() const noexcept { return w == 0 || h == 0; };
+    inline Rect intersect(const Rect& other) const noexcept;
+    inline Rect unite(const Rect& other) const noexcept;
+    Rect translate(const int32_t dx, const int32_t dy) const noexcept { return Rect{x + dx, y + dy, w, h}; };
+};
+
+Rect Rect::intersect(const Rect& other) const noexcept {
+    const int64_t x0 {std::max<int64_t>(x, other.x)};
+    const int64_t y0 {std::max<int64_t>(y, other.y)};
+    const int64_t x1 {std::min<int64_t>(int64_t{x} + w, int64_t{other.x} + other.w)};
+    const int64_t y1 {std::min<int64_t>(int64_t{y} + h, int64_t{other.y} + other.h)};
+    if (x1 <= x0 || y1 <= y0) {
+        return Rect{};
+    }
+    return Rect{static_cast<int32_t>(x0), static_cast<int32_t>(y0), static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0)};
+}
+
+// Returns the bounding box of both rectangles
+Rect Rect::unite(const Rect& other) const noexcept {
+    if (is_empty()) {
+        return other;
+    } else if (other.is_empty()) {
+        return *this;
+    }
+    const int64_t x0 {std::min<int64_t>(x, other.x)};
+    const int64_t y0 {std::min<int64_t>(y, other.y)};
+    const int64_t x1 {std::max<int64_t>(int64_t{x} + w, int64_t{other.x} + other.w)};
+    const int64_t y1 {std::max<int64_t>(int64_t{y} + h, int64_t{other.y} + other.h)};
+    return Rect{static_cast<int32_t>(x0), static_cast<int32_t>(y0), static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0)};
+}
+
 class DRMCard;
+class DRMAtomicRequest;
 class DRMCRTC;
 class DRMPlane;
 class DRMFramebuffer;
+struct ColourCorrection;
+class ColourTransform;
 
 // TODO: delete all copy constructors
 
+class DRMMode {
+public:
+    DRMMode(const drmModeModeInfo& info) noexcept;
+    bool operator==(const DRMMode& other) const noexcept;
+    bool operator!=(const DRMMode& other) const noexcept { return !(*this == other); };
+    bool is_better_than(const DRMMode& other) const noexcept;
+    bool is_preferred() const noexcept { return info.type & DRM_MODE_TYPE_PREFERRED; };
+    uint32_t get_area() const noexcept { return info.hdisplay * info.vdisplay; };
+    std::chrono::nanoseconds get_frame_interval() const noexcept;
+    const drmModeModeInfo& get_info() const noexcept { return info; };
+    std::string to_string() const noexcept;
+private:
+    drmModeModeInfo info;
+};
+
+// Snapshot of a connector's state, taken in a single ioctl so that the connection status, modes
+// and encoders are always consistent with each other
+struct DRMConnectorState {
+    drmModeConnection connection;
+    uint32_t encoder_id;
+    std::vector<DRMMode> modes;
+    std::vector<uint32_t> encoder_ids;
+};
+
 class DRMConnector {
 public:
     DRMConnector(DRMCard& card, const uint32_t id) noexcept;
     DRMConnector(const DRMConnector&) = delete;
     DRMConnector& operator=(const DRMConnector&) = delete;
     DRMCRTC& select_crtc() const;
-    std::vector<drmModeModeInfo> fetch_modes() const;
+    const std::vector<DRMMode>& get_modes() const { return get_state().modes; };
+    DRMMode select_mode() const;
+    bool supports_mode(const DRMMode& mode) const;
+    uint32_t fetch_crtc_id() const;
     uint32_t get_id() const noexcept { return id; };
-    bool is_connected() const;
+    bool is_connected() const { return get_state().connection == DRM_MODE_CONNECTED; };
+    void probe(const bool force) const;
+    void invalidate() const noexcept { state.reset(); };
     std::string to_string() const noexcept;
 private:
     // TODO: move out
-    DRMModeConnUniquePtr fetch_resource() const;
-    std::vector<uint32_t> fetch_encoder_ids() const;
+    DRMModeConnUniquePtr fetch_resource(const bool force) const;
+    const DRMConnectorState& get_state() const;
+    const std::vector<uint32_t>& get_encoder_ids() const { return get_state().encoder_ids; };
 
     DRMCard& card;
     const uint32_t id;
+    mutable std::optional<DRMConnectorState> state {};
+};
+
+// PlaneComposition is how a plane is combined with the others on its CRTC. The defaults are what a plane without the
+// "alpha", "zpos" and "pixel blend mode" properties does anyway
+struct PlaneComposition {
+    uint16_t alpha {0xFFFF}; // Opacity of the whole plane
+    std::optional<uint32_t> zpos {}; // Higher planes are shown above lower ones. Unset leaves the driver's order
+    PlaneBlendMode blend_mode {PlaneBlendMode::PREMULTIPLIED};
+
+    bool is_default() const noexcept { return alpha == 0xFFFF && !zpos && blend_mode == PlaneBlendMode::PREMULTIPLIED; };
 };
 
 class DRMPlane {
@@ -70,7 +169,15 @@ public:
     DRMPlane(DRMCard& card, const uint32_t id) noexcept;
     DRMPlane(const DRMPlane&) = delete;
     DRMPlane& operator=(const DRMPlane&) = delete;
-    void repaint(const DRMCRTC& crtc, DRMFramebuffer& fb, const int32_t x, const int32_t y);
+    bool repaint(const DRMCRTC& crtc, DRMFramebuffer& fb, const int32_t x, const int32_t y, void* flip_data = nullptr);
+    bool repaint(const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src, const int32_t x, const int32_t y,
+        void* flip_data = nullptr);
+    bool test(const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src, const int32_t x, const int32_t y) const;
+    void disable();
+    void add_to_request(const DRMAtomicRequest& req, const DRMCRTC& crtc, DRMFramebuffer& fb, const int32_t x,
+        const int32_t y) const;
+    void add_to_request(const DRMAtomicRequest& req, const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src,
+        const int32_t x, const int32_t y) const;
     bool is_in_use() const noexcept { return in_use; }; // TODO: could a CRTC id ever be 0?
     void claim() { in_use = true; }; // TODO: lock usage?
     void release() { in_use = false; };
@@ -78,18 +185,32 @@ public:
     bool is_cursor_plane() const;
     bool is_overlay_plane() const;
     bool is_compatible_with(const DRMCRTC& crtc) const;
+    bool supports_format(const uint32_t format) const;
     void set_pos(const uint32_t x, const uint32_t y) { this->x = x; this->y = y; }; // TODO: bounds check
+    bool can_compose(const PlaneComposition& composition) const;
+    void set_composition(const PlaneComposition& composition) noexcept { this->composition = composition; };
     uint32_t get_id() const noexcept { return id; }
     std::string to_string() const noexcept;
 private:
+    // Which composition properties the plane has, and the values of the blend modes it offers
+    struct CompositionProperties {
+        bool alpha {false};
+        bool zpos {false};
+        std::array<std::optional<uint64_t>, 3> blend_modes {}; // Indexed by PlaneBlendMode
+    };
+
     DRMModePlaneUniquePtr fetch_resource() const;
     uint32_t get_possible_crtcs() const;
+    const CompositionProperties& get_composition_properties() const;
+    void add_composition_to_request(const DRMAtomicRequest& req) const;
 
     DRMCard& card;
     bool in_use {false};
     const uint32_t id;
     uint32_t x {0};
     uint32_t y {0};
+    PlaneComposition composition {}; // Sent with every atomic commit showing a framebuffer on the plane
+    mutable std::optional<CompositionProperties> composition_properties {}; // Fetched on first use
 };
 
 class DRMCRTC {
@@ -100,18 +221,24 @@ public:
     uint32_t get_id() const noexcept { return id; };
     uint32_t get_index() const noexcept { return index; };
     void modeset(const DRMConnector& conn);
+    std::optional<DRMMode> fetch_current_mode() const;
     DRMPlane& claim_unused_primary_plane() const;
     DRMPlane& claim_unused_cursor_plane() const;
     DRMPlane& claim_unused_overlay_plane() const;
+    DRMPlane& claim_unused_overlay_plane(const uint32_t format) const;
     uint32_t get_width() const;
     uint32_t get_height() const;
     int32_t get_x() const;
     int32_t get_y() const;
     void add_connector(const DRMConnector& conn) noexcept;
+    void remove_connector(const uint32_t conn_id) noexcept;
     bool is_connected() const noexcept;
+    bool set_colour_correction(const ColourCorrection& correction);
     std::string to_string() const noexcept;
 private:
     DRMModeCRTCUniquePtr fetch_resource() const;
+    bool can_inherit(const DRMConnector& conn) const;
+    void apply_mode(const DRMMode& mode);
 
     // TODO: const (and fields in other classes)
     DRMCard& card;
@@ -125,6 +252,7 @@ public:
     DRMEncoder(const DRMEncoder&) = delete;
     DRMEncoder& operator=(const DRMEncoder&) = delete;
     DRMCRTC& select_crtc() const;
+    uint32_t fetch_crtc_id() const { return fetch_resource()->crtc_id; };
     std::string to_string() const noexcept;
 private:
     DRMModeEncoderUniquePtr fetch_resource() const;
@@ -145,23 +273,29 @@ public:
 	void set_capabilities();
 	void load_resources();
 	void configure_connectors() noexcept;
+	void handle_hotplug() noexcept;
 	DRMCRTC& get_connected_crtc();
     DRMCRTC& get_crtc_by_id(const uint32_t id);
     DRMEncoder& get_encoder_by_id(const uint32_t id);
     DRMPlane& get_unused_overlay_plane(const DRMCRTC& crtc);
+    DRMPlane& get_unused_overlay_plane(const DRMCRTC& crtc, const uint32_t format);
     DRMPlane& get_unused_primary_plane(const DRMCRTC& crtc); // TODO: use friend to limit access to DRMCRTC
     DRMPlane& get_unused_cursor_plane(const DRMCRTC& crtc);
     bool are_atomic_commits_enabled() const noexcept { return atomic_commits_enabled; };
+    bool supports_prime_import() const;
+    uint64_t max_cursor_width() const;
+    uint64_t max_cursor_height() const;
+    bool enable_writeback_connectors() noexcept;
+    uint32_t find_writeback_connector(const DRMCRTC& crtc) const;
 private:
     int open_device(const std::string& path) const;
     uint64_t fetch_capability(const uint64_t capability) const;
     bool supports_async_page_flip() const;
     bool supports_dumb_buffers() const;
     bool supports_monotonic_timestamp() const;
-    uint64_t max_cursor_width() const;
-    uint64_t max_cursor_height() const;
     void enable_universal_planes();
     void enable_atomic_commits();
+    bool is_writeback_connector(const uint32_t id) const;
 
     const int fd;
     std::map<uint32_t, DRMConnector> connectors {};
@@ -172,6 +306,7 @@ private:
     std::vector<uint32_t> plane_ids {};
 
     bool atomic_commits_enabled {false};
+    bool writeback_connectors_enabled {false};
 };
 
 class DRMException : public std::runtime_error {
@@ -181,11 +316,15 @@ public:
     DRMException(const std::string msg, const int errnum) noexcept;
     DRMException(const std::string msg, const std::exception& e) noexcept;
     DRMException(const std::exception& e, const std::string extra) noexcept;
+    int get_errnum() const noexcept { return errnum; }; // 0 if the failure didn't come with an errno
+private:
+    int errnum {0};
 };
 
 class DRMPropertyBlob {
 public:
     DRMPropertyBlob(const DRMCard& card, const drmModeModeInfo* mode);
+    DRMPropertyBlob(const DRMCard& card, const void* data, const size_t size);
     DRMPropertyBlob(const DRMPropertyBlob&) = delete;
     DRMPropertyBlob& operator=(const DRMPropertyBlob&) = delete;
     ~DRMPropertyBlob();
@@ -203,8 +342,9 @@ public:
     DRMAtomicRequest& operator=(const DRMAtomicRequest&) = delete;
     ~DRMAtomicRequest();
 	void add_property(const uint32_t obj_id, const uint32_t obj_type, const char* prop_name, const uint64_t val) const;
-	void commit(const uint32_t flags) const;
+	void commit(const uint32_t flags, void* user_data = nullptr) const;
     void commit() const;
+    bool test() const noexcept;
 private:
     const DRMCard& card;
     drmModeAtomicReq* req;
@@ -213,11 +353,17 @@ private:
 class DRMProperties {
 public:
     DRMProperties(const DRMCard& card, const DRMPlane& plane);
+    DRMProperties(const DRMCard& card, const uint32_t obj_id, const uint32_t obj_type);
     DRMProperties(const DRMProperties&) = delete;
     DRMProperties& operator=(const DRMProperties&) = delete;
     ~DRMProperties();
     uint64_t operator[](const std::string name) const;
+    bool has(const std::string& name) const;
+    bool is_settable(const std::string& name) const;
+    std::optional<uint64_t> get_enum_value(const std::string& name, const std::string& enum_name) const;
 private:
+    DRMModePropertyUniquePtr find(const std::string& name) const;
+
     const DRMCard& card;
     drmModeObjectProperties* props;
 };
@@ -226,19 +372,65 @@ class Buffer {
 public:
     virtual ~Buffer() {};
     uint8_t* get_buffer() noexcept { return buffer; };
+    const uint8_t* get_buffer() const noexcept { return buffer; };
     virtual uint32_t get_width() const noexcept = 0;
     virtual uint32_t get_height() const noexcept = 0;
     virtual uint32_t get_size() const noexcept = 0;
+    virtual uint32_t get_stride() const noexcept { return get_width() * 4; };
+    Rect get_bounds() const noexcept { return Rect{0, 0, get_width(), get_height()}; };
     void fill(const style::Colour c) const noexcept;
-    void paint(Buffer& dst, const int32_t x, const int32_t y, bool over) const noexcept;
+    void fill(const style::Colour c, const Rect& area) const noexcept;
+    void blend_rect(const style::Colour c, const Rect& area) const noexcept;
+    void blend_span(const int32_t x, const int32_t y, const uint32_t len, const style::Colour c) const noexcept;
+    void blend_pixel(const int32_t x, const int32_t y, const style::Colour c, const uint8_t coverage) const noexcept;
+    void blend_mask(const uint8_t* mask, const uint32_t mask_stride, const uint32_t w, const uint32_t h,
+        const int32_t x, const int32_t y, const style::Colour c) const noexcept;
+    void paint(Buffer& dst, const int32_t x, const int32_t y, bool over,
+        const style::BlendQuality quality = style::BlendQuality::FAST) const noexcept;
+    void paint(Buffer& dst, const Rect& area, const int32_t x, const int32_t y, bool over,
+        const style::BlendQuality quality = style::BlendQuality::FAST) const noexcept;
+    void paint(Buffer& dst, const int32_t x, const int32_t y, const style::BlendOperator op,
+        const bool opaque = false) const noexcept;
+    void paint(Buffer& dst, const Rect& area, const int32_t x, const int32_t y, const style::BlendOperator op,
+        const bool opaque = false) const noexcept;
+    void paint_faded(Buffer& dst, const Rect& area, const int32_t x, const int32_t y, const uint8_t opacity,
+        const PlaneBlendMode mode) const noexcept;
+    std::vector<Rect> copy_area(const Rect& area, const int32_t dx, const int32_t dy) const noexcept;
+    void box_blur(const Rect& area, const uint32_t radius) const noexcept;
+    void gaussian_blur(const Rect& area, const float sigma) const noexcept;
 protected:
     uint8_t* buffer {nullptr};
 private:
+    void blur(const Rect& area, const std::vector<uint32_t>& radii) const noexcept;
     void src_blend(const Buffer& dst, const uint32_t x, const uint32_t y, const uint32_t src_x, const uint32_t src_y, const uint32_t src_w, const uint32_t src_h) const noexcept;
-    void src_over_blend(const Buffer& dst, const uint32_t x, const uint32_t y, const uint32_t src_x, const uint32_t src_y, const uint32_t src_w, const uint32_t src_h) const noexcept;
+    void src_over_blend(const Buffer& dst, const uint32_t x, const uint32_t y, const uint32_t src_x, const uint32_t src_y, const uint32_t src_w, const uint32_t src_h, const style::BlendQuality quality) const noexcept;
     uint32_t pixel_src_over(const uint32_t dst_v, const uint32_t src_v) const noexcept;
 };
 
+// Rasteriser draws shapes into a buffer one scanline at a time. Pixels fully inside a shape are drawn as solid spans,
+// so only the pixels along its edges need per-pixel coverage and blending. Colours are blended src-over
+class Rasteriser {
+public:
+    Rasteriser(Buffer& target, const bool antialias = true) noexcept : target{target}, antialias{antialias} {};
+    Rasteriser(const Rasteriser&) = delete;
+    Rasteriser& operator=(const Rasteriser&) = delete;
+    void fill_rect(const float x, const float y, const float w, const float h, const style::Colour c) const noexcept;
+    void fill_rect(const Rect& rect, const style::Colour c) const noexcept;
+    void stroke_rect(const Rect& rect, const uint32_t width, const style::Colour c) const noexcept;
+    void fill_rounded_rect(const float x, const float y, const float w, const float h, const float radius,
+        const style::Colour c) const noexcept;
+    void fill_circle(const float cx, const float cy, const float radius, const style::Colour c) const noexcept;
+    void draw_line(const float x0, const float y0, const float x1, const float y1, const float width,
+        const style::Colour c) const noexcept;
+private:
+    template <typename Extent, typename Distance>
+    void scan(const float top, const float bottom, const style::Colour c, const Extent& extent,
+        const Distance& distance) const noexcept;
+
+    Buffer& target;
+    const bool antialias;
+};
+
 class MemBuffer : public Buffer {
 public:
     MemBuffer(const uint32_t width, const uint32_t height, const uint32_t bpp);
@@ -253,88 +445,391 @@ private:
     const uint32_t width, height, bpp;
 };
 
+// ShadowCache makes drop shadows: a shape's silhouette in the shadow's colour, Gaussian blurred. A shadow extends
+// get_padding(sigma) pixels beyond its shape on every side. Shadows of rounded rectangles, the usual case, are kept, so
+// a static shadow is blurred once rather than every frame. As in image::ImageCache, the least recently used shadows
+// are dropped when the budget is exceeded, and a shadow stays valid for as long as someone holds it
+class ShadowCache {
+public:
+    ShadowCache(const size_t max_bytes = 16 << 20) noexcept : cache{max_bytes} {};
+    ShadowCache(const ShadowCache&) = delete;
+    ShadowCache& operator=(const ShadowCache&) = delete;
+    static ShadowCache& the();
+    std::shared_ptr<const MemBuffer> get(const uint32_t w, const uint32_t h, const float corner_radius,
+        const float sigma, const style::Colour c);
+    static std::unique_ptr<MemBuffer> make_shadow(const Buffer& shape, const float sigma, const style::Colour c);
+    static uint32_t get_padding(const float sigma) noexcept;
+    void set_max_bytes(const size_t bytes) noexcept { cache.set_max_bytes(bytes); };
+    size_t get_max_bytes() const noexcept { return cache.get_max_bytes(); };
+    size_t get_used_bytes() const noexcept { return cache.get_used_bytes(); };
+    void clear() noexcept { cache.clear(); };
+private:
+    static std::string make_key(const uint32_t w, const uint32_t h, const float corner_radius, const float sigma,
+        const style::Colour c);
+
+    cache::LRUByteCache<MemBuffer> cache;
+};
+
+// ColourCorrection describes an adjustment to everything a CRTC shows: a matrix applied in linear light (for
+// calibration or night-mode tinting), a brightness and a gamma. CRTCs with colour management properties apply it in
+// hardware, at no cost per frame
+struct ColourCorrection {
+    std::array<float, 9> matrix {1, 0, 0, 0, 1, 0, 0, 0, 1}; // Row-major, mapping linear RGB to linear RGB
+    float brightness {1.0f}; // Scales linear light
+    float gamma {1.0f}; // Applied on top of the sRGB encoding: values above 1 brighten mid-tones
+
+    static ColourCorrection night_mode(const float strength) noexcept;
+    bool is_identity() const noexcept;
+    bool is_diagonal() const noexcept;
+    float apply(const uint32_t channel, const float encoded) const noexcept;
+    std::vector<drm_color_lut> degamma_lut(const uint32_t size) const;
+    std::vector<drm_color_lut> gamma_lut(const uint32_t size, const bool with_matrix) const;
+    drm_color_ctm ctm() const noexcept;
+};
+
+// ColourTransform applies a ColourCorrection in software, for CRTCs which can't. Diagonal corrections (brightness,
+// night mode) become a lookup per channel; others go through linear light
+class ColourTransform {
+public:
+    ColourTransform(const ColourCorrection& correction);
+    void apply(const Buffer& src, Buffer& dst) const noexcept;
+private:
+    bool diagonal;
+    std::array<std::array<uint8_t, 256>, 3> channel_luts {}; // Indexed by B, G, R, as in memory
+    std::array<uint16_t, 256> to_linear {};
+    std::array<uint8_t, 4096> to_encoded {};
+    std::array<int32_t, 9> matrix {}; // Q12, including brightness
+};
+
+// SharedMemBuffer is a buffer backed by a sealed memfd, so that its pixels can be shared between processes
+// by passing the fd rather than copying
+class SharedMemBuffer : public Buffer {
+public:
+    SharedMemBuffer(const uint32_t width, const uint32_t height);
+    SharedMemBuffer(const int fd, const uint32_t width, const uint32_t height, const uint32_t stride);
+    SharedMemBuffer(const SharedMemBuffer&) = delete;
+    SharedMemBuffer& operator=(const SharedMemBuffer&) = delete;
+    ~SharedMemBuffer();
+    int get_fd() const noexcept { return fd; };
+    uint32_t get_width() const noexcept { return width; };
+    uint32_t get_height() const noexcept { return height; };
+    uint32_t get_stride() const noexcept { return stride; };
+    uint32_t get_size() const noexcept { return stride * height; }; // Can't wrap: larger layouts are refused
+    static bool is_valid_layout(const uint32_t width, const uint32_t height, const uint64_t stride) noexcept;
+private:
+    static uint32_t make_stride(const uint32_t width, const uint32_t height);
+    int create_memfd() const;
+    void check_memfd() const;
+    void map();
+
+    const uint32_t width, height, stride;
+    const int fd;
+};
+
 class DRMFramebuffer : public Buffer {
 public:
     DRMFramebuffer(const DRMCard& card, DRMPlane& plane, const uint32_t w, const uint32_t h,
         const uint32_t bpp, const uint32_t pixel_format);
+    DRMFramebuffer(const DRMCard& card, const uint32_t w, const uint32_t h, const uint32_t bpp,
+        const uint32_t pixel_format);
+    DRMFramebuffer(const DRMCard& card, DRMPlane& plane, const int dmabuf_fd, const uint32_t w, const uint32_t h,
+        const uint32_t stride, const uint32_t pixel_format);
     DRMFramebuffer(const DRMFramebuffer&) = delete;
     DRMFramebuffer& operator=(const DRMFramebuffer&) = delete;
     ~DRMFramebuffer();
-    DRMPlane& get_plane() noexcept { return plane; };
+    DRMPlane& get_plane() noexcept { return *plane; }; // Only for framebuffers made for a plane
     uint32_t get_id() const noexcept { return id; };
     uint32_t get_size() const noexcept { return info.size; }; // TODO: avoid wasted painting cycles outside of visible part of framebuffer
     uint32_t get_width() const noexcept { return info.width; };
-    uint32_t get_height() const noexcept { return info.height; };
+    uint32_t get_height() const noexcept { return height; };
+    uint32_t get_stride() const noexcept { return info.pitch; };
+    uint32_t get_format() const noexcept { return pixel_format; };
+    uint8_t* get_chroma() noexcept;
+    void mark_dirty(const std::vector<Rect>& rects) const;
     void paint(DRMFramebuffer&, const int32_t, const int32_t, bool) const noexcept {};
+    void begin_cpu_access(const bool write) const;
+    void end_cpu_access(const bool write) const noexcept;
+
+    // CPUAccess brackets CPU reads (and writes, if write is set) of a framebuffer's pixels for its lifetime
+    class CPUAccess {
+    public:
+        CPUAccess(const DRMFramebuffer& fb, const bool write) : fb{fb}, write{write} { fb.begin_cpu_access(write); };
+        CPUAccess(const CPUAccess&) = delete;
+        CPUAccess& operator=(const CPUAccess&) = delete;
+        ~CPUAccess() { fb.end_cpu_access(write); };
+    private:
+        const DRMFramebuffer& fb;
+        const bool write;
+    };
 
 private:
+    DRMFramebuffer(const DRMCard& card, DRMPlane* plane, const uint32_t w, const uint32_t h, const uint32_t bpp,
+        const uint32_t pixel_format);
+    static uint32_t get_dumb_height(const uint32_t h, const uint32_t pixel_format);
+    static uint32_t get_bpp(const uint32_t pixel_format);
     void create_dumb_buffer();
     void add_framebuffer();
     void map_dumb_buffer();
+    void import_dmabuf(const int dmabuf_fd);
+    void map_dmabuf(const int dmabuf_fd);
+    bool close_handle() const noexcept;
 
     const DRMCard& card;
-    DRMPlane& plane;
+    DRMPlane* const plane; // Released when the framebuffer is destroyed; null for one which is never scanned out
     drm_mode_create_dumb info;
     const uint32_t pixel_format;
+    const uint32_t height; // NV12's chroma plane makes the dumb buffer taller than this
+    const bool imported {false};
+    int dmabuf_fd {-1}; // Our own copy of an imported dma-buf's fd, for syncing CPU access
     uint32_t id {0};
 };
 
-class ScreenBitmap {
+// Receives the page-flip event of a nonblocking commit it was passed to as flip_data
+class FlipListener {
+public:
+    virtual ~FlipListener() = default;
+    virtual void page_flip_complete() noexcept = 0;
+};
+
+class ScreenCapture;
+class CursorBitmap;
+
+// With a shadow, drawing goes to buffers in ordinary memory which are copied to the framebuffers when presented. The
+// copy costs a frame's worth of writes, but the frame can then be read back cheaply, which the write-combined
+// framebuffer memory can't
+class ScreenBitmap : public FlipListener {
 public:
     ScreenBitmap();
     ScreenBitmap(const ScreenBitmap&) = delete;
     ScreenBitmap& operator=(const ScreenBitmap&) = delete;
-    DRMFramebuffer* get_back_buffer() { return buffers[back].get(); };
-    void fill(const style::Colour c) const noexcept { buffers[back]->fill(c); };
+    Buffer* get_back_buffer() { return shadows[back] ? static_cast<Buffer*>(shadows[back].get()) : buffers[back].get(); };
+    void fill(const style::Colour c) noexcept { get_back_buffer()->fill(c); };
     DRMCRTC& get_crtc() { return crtc; };
+    DRMPlane& get_plane() { return plane; };
     void render();
+    bool flip();
+    bool is_flip_pending() const noexcept { return flip_pending; };
+    void page_flip_complete() noexcept override;
+    void enable_shadow();
+    void disable_shadow();
+    bool is_shadowed() const noexcept { return shadows[0] != nullptr; };
+    void set_capture(ScreenCapture* capture) noexcept { this->capture = capture; };
+    void set_colour_correction(const ColourCorrection& correction);
+    // A hardware cursor's moves can ride on the screen's commits; a software cursor draws itself into its framebuffers
+    void set_cursor(CursorBitmap* cursor) noexcept { this->cursor = cursor; };
+    DRMFramebuffer& get_framebuffer(const int index) noexcept { return *buffers[index]; };
+    int get_front() const noexcept { return back ^ 1; };
 private:
     std::array<std::unique_ptr<DRMFramebuffer>, 2> make_buffers() const;
     DRMCRTC& find_crtc();
+    bool present(FlipListener* flip_listener);
 
     int back {0};
+    bool flip_pending {false};
     const uint32_t width {0}, height {0}; // TODO
     DRMCRTC& crtc;
     DRMPlane& plane;
     const std::array<std::unique_ptr<DRMFramebuffer>, 2> buffers;
+    std::array<std::unique_ptr<MemBuffer>, 2> shadows {};
+    ScreenCapture* capture {nullptr};
+    std::unique_ptr<ColourTransform> colour_transform {}; // Applied when copying from the shadow
+    CursorBitmap* cursor {nullptr};
 };
 
-class CursorBitmap {
+// ScreenCapture records each frame a ScreenBitmap presents and streams it to an fd as raw video: width x height pixels
+// of 4 bytes in B, G, R, X order, rows packed, no headers. A writeback connector is used if the CRTC has one: the
+// display hardware then writes each frame out as part of the same commit that shows it, and its out-fence says when
+// the frame is complete. Otherwise the screen is switched to a shadow, which is copied at present time. Frames go
+// into a ring of preallocated buffers which a thread of its own writes out; if it falls behind, frames are dropped
+// rather than holding up presentation
+class ScreenCapture {
 public:
-    CursorBitmap();
+    ScreenCapture(ScreenBitmap& screen, const int out_fd, const uint32_t ring_size = 4);
+    ScreenCapture(const ScreenCapture&) = delete;
+    ScreenCapture& operator=(const ScreenCapture&) = delete;
+    ~ScreenCapture();
+    bool is_using_writeback() const noexcept { return writeback_connector != 0; };
+    uint64_t get_frames_written() const noexcept { return frames_written; };
+    uint64_t get_frames_dropped() const noexcept { return frames_dropped; };
+    // Called by ScreenBitmap when it presents a frame
+    bool add_to_request(const DRMAtomicRequest& req);
+    void committed();
+    void commit_failed() noexcept;
+    void frame_presented(const Buffer& frame);
+private:
+    enum class SlotState {FREE, CAPTURING, QUEUED};
+
+    static constexpr int fence_timeout_ms {100}; // Per frame still being written back when the capture ends
+
+    struct Slot {
+        std::unique_ptr<Buffer> buffer;
+        SlotState state {SlotState::FREE};
+        int32_t fence {-1}; // Written by the kernel during the commit
+        uint64_t watch_id {0};
+    };
+
+    uint32_t select_connector();
+    std::vector<Slot> make_slots(const uint32_t ring_size);
+    void attach_connector(const uint32_t crtc_id) const;
+    int acquire_slot();
+    void queue_slot(const int index);
+    void fence_signalled(const int index);
+    void write_frames();
+    bool write_frame(const Buffer& frame) const;
+
+    ScreenBitmap& screen;
+    DRMCard& card;
+    const int out_fd;
+    const uint32_t writeback_connector; // 0 when using the shadow
+    std::vector<Slot> slots;
+    int pending_slot {-1}; // Added to the commit in progress
+    std::mutex mutex {};
+    std::condition_variable queued {};
+    std::deque<int> queue {}; // Slots waiting to be written, oldest first
+    bool stopping {false};
+    std::atomic<uint64_t> frames_written {0};
+    std::atomic<uint64_t> frames_dropped {0};
+    std::thread writer {};
+};
+
+// CursorBitmap shows the pointer on a cursor plane, so moving it is one small commit. Where the CRTC has no cursor
+// plane, as on many virtual GPUs, a cursor given a screen draws itself into the screen's framebuffers instead. The
+// pixels beneath it are kept in a save-under buffer for each framebuffer, so a move only restores the old rectangle
+// and blends the new one, and just those two rectangles are flushed to the display. A hardware cursor given a screen
+// can also move as part of the screen's commits, which it otherwise can't get a commit in between while animating
+class CursorBitmap : public FlipListener {
+public:
+    CursorBitmap(ScreenBitmap* screen = nullptr);
     CursorBitmap(const CursorBitmap&) = delete;
     CursorBitmap& operator=(const CursorBitmap&) = delete;
-    DRMFramebuffer* get_back_buffer() { return buffers[back].get(); };
+    ~CursorBitmap();
+    Buffer* get_back_buffer() { return buffers[back].get(); };
     DRMCRTC& get_crtc() { return crtc; };
+    bool is_software() const noexcept { return plane == nullptr; };
     void render(const int32_t x, const int32_t y);
+    bool move(const int32_t x, const int32_t y);
+    bool is_move_pending() const noexcept { return move_pending; };
+    void page_flip_complete() noexcept override { move_pending = false; };
+    // Called by the cursor's ScreenBitmap as it commits, and, for a software cursor, as its framebuffers are shown and
+    // handed back for drawing
+    bool add_to_request(const DRMAtomicRequest& req) const;
+    void committed() noexcept;
+    Rect draw_into(const int index) noexcept;
+    Rect erase_from(const int index) noexcept;
 private:
-    std::array<std::unique_ptr<DRMFramebuffer>, 2> make_buffers() const;
     DRMCRTC& find_crtc();
+    DRMPlane* claim_plane() const;
+    uint32_t fetch_width() const;
+    uint32_t fetch_height() const;
+    std::array<std::unique_ptr<Buffer>, 2> make_buffers() const;
+    std::array<std::unique_ptr<MemBuffer>, 2> make_save_unders() const;
+    void redraw(const int32_t new_x, const int32_t new_y);
 
     int back {0};
-    const uint32_t width {0}, height {0}; // TODO
+    bool move_pending {false};
+    ScreenBitmap* const screen;
     DRMCRTC& crtc;
-    DRMPlane& plane;
-    const std::array<std::unique_ptr<DRMFramebuffer>, 2> buffers;
+    DRMPlane* const plane; // Null for a software cursor
+    const uint32_t width, height;
+    const std::array<std::unique_ptr<Buffer>, 2> buffers;
+    int32_t x {0}, y {0}; // Where the cursor was last shown, if it has been
+    bool positioned {false};
+    std::optional<std::pair<int32_t, int32_t>> folded {}; // A move waiting for the screen's next commit
+    // Software cursors only
+    const std::array<std::unique_ptr<MemBuffer>, 2> save_unders; // One for each of the screen's framebuffers
+    std::array<std::optional<Rect>, 2> saved_areas {}; // Where the cursor is drawn in each framebuffer, if it is
 };
 
+// The matrix for converting YUV to RGB, as chosen by the video's source. Most HD video is BT.709; SD video and many
+// webcams use BT.601
+enum class YUVEncoding {
+    BT601, BT709
+};
+
+// VideoSurface shows YUV video (NV12 or YUYV, as decoders and cameras produce it) on a screen. If an overlay plane
+// can scan the format out, frames are shown as they are and the CPU never touches their pixels. Otherwise each frame
+// is converted to ARGB straight into the screen's back buffer, eight pixels at a time
+class VideoSurface {
+public:
+    // A frame's planes: luma then interleaved chroma for NV12, or a single packed plane for YUYV
+    struct Frame {
+        std::array<uint8_t*, 2> data;
+        std::array<uint32_t, 2> strides;
+    };
+
+    VideoSurface(const uint32_t width, const uint32_t height, const uint32_t format,
+        const YUVEncoding encoding = YUVEncoding::BT709, const bool full_range = false);
+    VideoSurface(const VideoSurface&) = delete;
+    VideoSurface& operator=(const VideoSurface&) = delete;
+    Frame get_back_frame() noexcept;
+    bool is_scanned_out() const noexcept { return plane != nullptr; };
+    void render(ScreenBitmap& target, const int32_t x, const int32_t y);
+    static void convert(const Frame& frame, const uint32_t format, const uint32_t width, const uint32_t height,
+        const YUVEncoding encoding, const bool full_range, Buffer& dst, const int32_t x, const int32_t y) noexcept;
+private:
+    DRMPlane* claim_plane() const noexcept;
+    std::array<std::unique_ptr<DRMFramebuffer>, 2> make_framebuffers();
+    std::array<std::vector<uint8_t>, 2> make_frames() const;
+    void add_colour_properties(const DRMAtomicRequest& req) const;
+
+    const uint32_t width, height, format;
+    const YUVEncoding encoding;
+    const bool full_range;
+    DRMPlane* plane; // The overlay plane showing the video, if one can
+    const std::array<std::unique_ptr<DRMFramebuffer>, 2> framebuffers;
+    std::array<std::vector<uint8_t>, 2> frames; // Frames to be converted, when no plane can show them
+    int back {0};
+};
+
+// Bitmap buffers are only allocated when something is drawn into them. A buffer which has been filled with a single
+// colour has no storage at all: painting it is a rectangle fill, or a blend with a constant colour. The second buffer
+// therefore costs nothing until the bitmap is actually double-buffered. Opacity, stacking order and blend mode are
+// applied by the plane of a hardware-backed bitmap where it can, so fading or raising it costs no pixel work
 class Bitmap {
 public:
     Bitmap(const uint32_t width, const uint32_t height, const bool transparency = true, const bool hardware_backing = false);
     Bitmap(const Bitmap&) = delete;
     Bitmap& operator=(const Bitmap&) = delete;
-    Buffer* get_back_buffer() { return buffers[back].get(); };
-    void fill(const style::Colour c) const noexcept { buffers[back]->fill(c); };
+    Buffer* get_back_buffer() { return &materialise(back); };
+    void fill(const style::Colour c) noexcept;
+    bool is_solid() const noexcept { return solid[back].has_value(); };
+    void set_blend_quality(const style::BlendQuality quality) noexcept { blend_quality = quality; };
+    void set_viewport(const int32_t src_x, const int32_t src_y, const uint32_t w, const uint32_t h) noexcept;
+    void clear_viewport() noexcept { viewport.reset(); };
+    Rect get_viewport() const noexcept { return viewport ? *viewport : Rect{0, 0, width, height}; };
+    void set_opacity(const uint8_t opacity) noexcept { composition.alpha = opacity * 0x101; };
+    uint8_t get_opacity() const noexcept { return composition.alpha >> 8; };
+    void set_zpos(const uint32_t zpos) noexcept;
+    void set_blend_mode(const PlaneBlendMode mode) noexcept;
     void render(Bitmap& target, const int32_t x, const int32_t y);
     void render(ScreenBitmap& target, const int32_t x, const int32_t y);
+    void composite(Buffer& dst, const Rect& area, const int32_t x, const int32_t y) const noexcept;
+    void composite(Buffer& dst, const Rect& area, const int32_t x, const int32_t y, const bool over) const noexcept;
 private:
     std::array<std::unique_ptr<Buffer>, 2> make_buffers() const;
     DRMPlane& find_plane(const DRMCRTC& crtc, const BufferType buffer_type) const;
+    Buffer& materialise(const int index);
+    void paint_back_buffer(Buffer& dst, const int32_t x, const int32_t y) const noexcept;
+    bool is_plain() const noexcept {
+        return composition.alpha == 0xFFFF && composition.blend_mode == PlaneBlendMode::PREMULTIPLIED;
+    };
+    std::optional<uint32_t> get_shown_solid() const noexcept;
+    std::optional<uint32_t> get_shown_solid(const bool over) const noexcept;
+    bool plane_accepts(DRMPlane& plane, const DRMCRTC& crtc, DRMFramebuffer& fb, const Rect& src, const int32_t x,
+        const int32_t y);
 
     int back {0};
     const uint32_t width, height;
     const bool transparency, hardware_backing;
-    const std::array<std::unique_ptr<Buffer>, 2> buffers;
+    style::BlendQuality blend_quality {style::BlendQuality::FAST};
+    std::array<std::unique_ptr<Buffer>, 2> buffers;
+    std::array<std::optional<uint32_t>, 2> solid {}; // Premultiplied ARGB filling the whole buffer, if it's solid
+    std::optional<Rect> viewport {}; // The part of the bitmap which is shown, if not all of it
+    std::optional<Rect> tested_viewport {}; // The last viewport the plane was asked about
+    int32_t tested_x {0}, tested_y {0}; // And where it was to be shown
+    bool plane_accepted {false}; // Its answer
+    bool on_plane {false}; // Whether the plane is showing the bitmap
+    PlaneComposition composition {};
 };
 
 }
@@ -0,0 +1,115 @@
+#include "gui.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace gui {
+
+DisplayClient::DisplayClient(const std::string socket_path) : fd{connect_socket(socket_path)} {}
+
+DisplayClient::~DisplayClient() {
+    surfaces.clear();
+    close(fd);
+}
+
+int DisplayClient::connect_socket(const std::string& path) const {
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw GUIException{"socket path is too long: " + path};
+    }
+    path.copy(addr.sun_path, path.size());
+
+    const auto fd {socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)};
+    if (fd < 0) {
+        throw GUIException{"failed to create socket", errno};
+    }
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        const auto err {errno};
+        close(fd);
+        throw GUIException{"failed to connect to " + path, err};
+    }
+    return fd;
+}
+
+uint32_t DisplayClient::create_surface(const uint32_t width, const uint32_t height, const int32_t x, const int32_t y) {
+    auto buffer {std::make_unique<drm::SharedMemBuffer>(width, height)};
+
+    Message msg {};
+    msg.type = MessageType::ATTACH;
+    msg.surface_id = next_id;
+    msg.x = x;
+    msg.y = y;
+    msg.width = width;
+    msg.height = height;
+    msg.stride = buffer->get_stride();
+    send(msg, buffer->get_fd());
+
+    surfaces.emplace(next_id, std::move(buffer));
+    return next_id++;
+}
+
+// Tells the server which parts of the surface have changed since the last commit
+void DisplayClient::commit(const uint32_t id, const std::vector<drm::Rect>& damage) const {
+    Message msg {};
+    msg.type = MessageType::COMMIT;
+    msg.surface_id = id;
+    msg.damage_count = std::min<uint32_t>(damage.size(), max_damage_rects);
+    std::copy_n(damage.begin(), msg.damage_count, msg.damage);
+
+    // Fold any rectangles that don't fit into the last one
+    for (size_t i {max_damage_rects}; i < damage.size(); i++) {
+        msg.damage[max_damage_rects - 1] = msg.damage[max_damage_rects - 1].unite(damage[i]);
+    }
+
+    send(msg);
+}
+
+void DisplayClient::commit(const uint32_t id) const {
+    commit(id, {surfaces.at(id)->get_bounds()});
+}
+
+void DisplayClient::move_surface(const uint32_t id, const int32_t x, const int32_t y) const {
+    Message msg {};
+    msg.type = MessageType::MOVE;
+    msg.surface_id = id;
+    msg.x = x;
+    msg.y = y;
+    send(msg);
+}
+
+void DisplayClient::destroy_surface(const uint32_t id) {
+    Message msg {};
+    msg.type = MessageType::DESTROY;
+    msg.surface_id = id;
+    send(msg);
+
+    surfaces.erase(id);
+}
+
+void DisplayClient::send(const Message& msg, const int passed_fd) const {
+    iovec iov {const_cast<Message*>(&msg), sizeof(msg)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] {};
+    msghdr hdr {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    if (passed_fd >= 0) {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        auto cmsg {CMSG_FIRSTHDR(&hdr)};
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+    }
+
+    if (sendmsg(fd, &hdr, MSG_NOSIGNAL) < 0) {
+        throw GUIException{"failed to send message to server", errno};
+    }
+}
+
+}
@@ -1,12 +1,57 @@
 #include "gui.h"
 #include "drm.h"
+#include "../logging/logging.h"
+#include "../trace/trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <string>
+#include <linux/netlink.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <xf86drm.h>
 
 namespace gui {
 
-DisplayManager::DisplayManager(const std::string drm_card_path) : card{drm_card_path} {}
+DisplayManager::DisplayManager(const std::string drm_card_path) :
+        card{drm_card_path}, card_name{drm_card_path.substr(drm_card_path.rfind("/dri/") + 1)},
+        epoll_fd{create_epoll()}, wakeup_fd{create_wakeup()} {
+    add_watch(card.get_fd(), false, EPOLLIN, EventPriority::DISPLAY, [this](const uint32_t) { handle_drm_events(); });
+
+    const auto uevent_fd {create_uevent_socket()};
+    if (uevent_fd >= 0) {
+        add_watch(uevent_fd, true, EPOLLIN, EventPriority::DISPLAY, [this, uevent_fd](const uint32_t) {
+            handle_uevents(uevent_fd);
+        });
+    }
+
+    add_watch(wakeup_fd, false, EPOLLIN, EventPriority::DISPLAY, [this](const uint32_t) {
+        // EAGAIN only means another wakeup already reset the counter
+        uint64_t count;
+        if (read(wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            LOG_ERROR("failed to read wakeup eventfd: " << std::strerror(errno));
+        }
+        request_frame();
+    });
+    PipeScheduler::the().set_wakeup_fd(wakeup_fd);
+}
+
+DisplayManager::~DisplayManager() {
+    PipeScheduler::the().set_wakeup_fd(-1);
+    for (const auto& [id, watch]: watches) {
+        if (watch.owned) {
+            close(watch.fd);
+        }
+    }
+    close(wakeup_fd);
+    close(epoll_fd);
+}
 
 DisplayManager& DisplayManager::the() {
+    logging::Logger::the(); // Made first, so that what is logged while the display manager is destroyed is flushed
     static DisplayManager instance {"/dev/dri/card0"}; // TODO: allow this to be set. Make DM not a singleton?
     return instance;
 }
@@ -15,4 +60,285 @@ drm::DRMCard& DisplayManager::get_drm_card() noexcept {
     return card;
 }
 
+// Switches into display-server mode, compositing surfaces from client processes
+DisplayServer& DisplayManager::serve(const std::string socket_path) {
+    if (!server) {
+        server = std::make_unique<DisplayServer>(socket_path);
+        add_watch(server->get_fd(), false, EPOLLIN, EventPriority::DISPLAY, [this](const uint32_t) {
+            server->dispatch(0);
+        });
+    }
+    return *server;
+}
+
+int DisplayManager::create_epoll() const {
+    const auto fd {epoll_create1(EPOLL_CLOEXEC)};
+    if (fd < 0) {
+        throw GUIException{"failed to create epoll instance", errno};
+    }
+    return fd;
+}
+
+int DisplayManager::create_wakeup() const {
+    const auto fd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+    if (fd < 0) {
+        throw GUIException{"failed to create eventfd", errno};
+    }
+    return fd;
+}
+
+// Listens for the kernel's uevents, which is how hotplugs are announced. udev isn't needed to receive them. Without
+// this socket (some containers forbid it), connectors are only probed at startup
+int DisplayManager::create_uevent_socket() const noexcept {
+    const auto fd {socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT)};
+    if (fd < 0) {
+        LOG_WARNING("cannot watch for hotplugs: " << std::strerror(errno));
+        return -1;
+    }
+
+    sockaddr_nl addr {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; // The kernel's own broadcasts, rather than udev's
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        LOG_WARNING("cannot watch for hotplugs: " << std::strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Watches a user-supplied fd, which stays owned by the caller. Returns an ID for remove_fd
+uint64_t DisplayManager::add_fd(const int fd, const uint32_t events, const EventPriority priority, FDCallback callback) {
+    return add_watch(fd, false, events, priority, std::move(callback));
+}
+
+uint64_t DisplayManager::add_watch(const int fd, const bool owned, const uint32_t events, const EventPriority priority,
+        FDCallback callback) {
+    // Events carry the watch ID rather than the fd, so that an event for a removed watch can't reach a new watch on a
+    // reused fd number
+    const auto id {next_id++};
+    epoll_event ev {};
+    ev.events = events;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        const auto err {errno};
+        if (owned) {
+            close(fd);
+        }
+        throw GUIException{"failed to watch fd " + std::to_string(fd), err};
+    }
+
+    watches.emplace(id, Watch{fd, owned, priority, std::make_shared<FDCallback>(std::move(callback))});
+    return id;
+}
+
+void DisplayManager::remove_fd(const uint64_t id) noexcept {
+    const auto it {watches.find(id)};
+    if (it == watches.end()) {
+        return;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    if (it->second.owned) {
+        close(it->second.fd);
+    }
+    watches.erase(it);
+}
+
+// Calls callback after interval, and then every interval if repeat is set. Returns an ID for cancel_timer
+uint64_t DisplayManager::add_timer(const std::chrono::nanoseconds interval, const bool repeat,
+        std::function<void()> callback, const EventPriority priority) {
+    const auto fd {timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)};
+    if (fd < 0) {
+        throw GUIException{"failed to create timer", errno};
+    }
+
+    // A zero it_value would disarm the timer
+    const auto ns {std::max<int64_t>(1, interval.count())};
+    itimerspec spec {};
+    spec.it_value = timespec{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+    if (repeat) {
+        spec.it_interval = spec.it_value;
+    }
+    if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+        const auto err {errno};
+        close(fd);
+        throw GUIException{"failed to arm timer", err};
+    }
+
+    const auto id {next_id}; // The ID add_watch is about to assign
+    return add_watch(fd, true, EPOLLIN, priority, [this, fd, id, repeat, callback{std::move(callback)}](const uint32_t) {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) < 0) {
+            return;
+        }
+        if (!repeat) {
+            remove_fd(id);
+        }
+        callback();
+    });
+}
+
+// Queues a task to run on the loop. IDLE tasks run one at a time between checks for new events
+void DisplayManager::post(std::function<void()> task, const EventPriority priority) {
+    events.push(Event{priority, next_sequence++, std::move(task)});
+}
+
+// Called by ScreenBitmap::flip(). No frames are rendered until the flip has happened
+void DisplayManager::flip_queued(drm::ScreenBitmap& screen) {
+    flipping.push_back(&screen);
+}
+
+// Runs the event loop until quit() is called. Sleeps whenever there is nothing to do
+void DisplayManager::run() {
+    running = true;
+    while (running) {
+        const bool busy {!events.empty() || (frame_requested && flipping.empty())};
+        wait_for_events(busy ? 0 : -1);
+        dispatch_events();
+        if (running && frame_requested && flipping.empty()) {
+            render_frame();
+        }
+    }
+}
+
+// Queues an event for every ready fd
+void DisplayManager::wait_for_events(const int timeout_ms) {
+    epoll_event ready[32];
+    int n;
+    {
+        TRACE_SCOPE("DisplayManager::epoll_wait");
+        n = epoll_wait(epoll_fd, ready, 32, timeout_ms);
+    }
+    if (n < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throw GUIException{"failed to wait for events", errno};
+    }
+
+    for (int i {0}; i < n; i++) {
+        const auto id {ready[i].data.u64};
+        const auto revents {ready[i].events};
+        const auto it {watches.find(id)};
+        if (it == watches.end()) {
+            continue;
+        }
+        events.push(Event{it->second.priority, next_sequence++, [this, id, revents]() {
+            // The watch may have been removed by an earlier event. Holding a reference keeps the callback alive even
+            // if it removes its own watch
+            const auto it {watches.find(id)};
+            if (it != watches.end()) {
+                const auto callback {it->second.callback};
+                (*callback)(revents);
+            }
+        }});
+    }
+}
+
+// Dispatches queued events in priority order. At most one IDLE event runs before returning to check for new events,
+// so long-running background work can't delay input
+void DisplayManager::dispatch_events() {
+    while (!events.empty() && running) {
+        const bool idle {events.top().priority == EventPriority::IDLE};
+        auto callback {std::move(const_cast<Event&>(events.top()).callback)};
+        events.pop();
+        callback();
+        if (idle) {
+            break;
+        }
+    }
+}
+
+// Page-flip timestamps are CLOCK_MONOTONIC, the same clock as steady_clock on Linux
+static void handle_page_flip(int, unsigned int, const unsigned int tv_sec, const unsigned int tv_usec, unsigned int,
+        void* user_data) {
+    const std::chrono::steady_clock::time_point time {std::chrono::seconds{tv_sec} + std::chrono::microseconds{tv_usec}};
+    TRACE_INSTANT("vblank");
+    DisplayManager::the().vblank_occurred(time);
+    static_cast<drm::FlipListener*>(user_data)->page_flip_complete(); // Flip data is always a FlipListener*
+}
+
+void DisplayManager::handle_drm_events() {
+    drmEventContext ctx {};
+    ctx.version = DRM_EVENT_CONTEXT_VERSION;
+    ctx.page_flip_handler2 = handle_page_flip;
+    drmHandleEvent(card.get_fd(), &ctx);
+
+    flipping.erase(std::remove_if(flipping.begin(), flipping.end(), [](const auto screen) {
+        return !screen->is_flip_pending();
+    }), flipping.end());
+}
+
+// A uevent is a header then NUL-separated KEY=value pairs. Only the card's HOTPLUG=1 events matter, and only those sent
+// by the kernel itself, so that another process can't trigger probes
+void DisplayManager::handle_uevents(const int fd) {
+    char buf[4096];
+    while (true) {
+        sockaddr_nl sender {};
+        socklen_t sender_len {sizeof(sender)};
+        const auto n {recvfrom(fd, buf, sizeof(buf) - 1, 0, reinterpret_cast<sockaddr*>(&sender), &sender_len)};
+        if (n <= 0) {
+            return;
+        }
+        if (sender.nl_pid != 0) {
+            continue;
+        }
+        buf[n] = '\0';
+
+        bool drm {false}, hotplug {false}, ours {false};
+        for (const char* p {buf}; p < buf + n; p += std::strlen(p) + 1) {
+            const std::string field {p};
+            drm |= field == "SUBSYSTEM=drm";
+            hotplug |= field == "HOTPLUG=1";
+            ours |= field == "DEVNAME=" + card_name;
+        }
+        if (drm && hotplug && ours) {
+            card.handle_hotplug();
+            frame_interval = std::chrono::nanoseconds{0}; // The mode may have changed
+            request_frame();
+        }
+    }
+}
+
+std::chrono::nanoseconds DisplayManager::get_frame_interval() {
+    if (frame_interval.count() == 0) {
+        frame_interval = std::chrono::nanoseconds{16666667};
+        try {
+            const auto mode {card.get_connected_crtc().fetch_current_mode()};
+            if (mode) {
+                frame_interval = mode->get_frame_interval();
+            }
+        } catch (const drm::DRMException& e) {
+            LOG_WARNING("cannot read refresh rate, assuming 60Hz: " << e.what());
+        }
+    }
+    return frame_interval;
+}
+
+// Extrapolates the first vblank after the given time from the last one seen. Every nonblocking commit brings a fresh
+// timestamp, so the prediction only drifts while nothing on screen changes
+std::chrono::steady_clock::time_point DisplayManager::predict_vblank(const std::chrono::steady_clock::time_point after) {
+    const auto interval {get_frame_interval()};
+    if (last_vblank.time_since_epoch().count() == 0) {
+        return after + interval; // No vblank seen yet: any phase is as good as another
+    }
+    if (after < last_vblank) {
+        return last_vblank;
+    }
+    const auto frames {(after - last_vblank) / interval + 1};
+    return last_vblank + frames * interval;
+}
+
+// Delivers the latest pipe values, then renders. Pipe values are only delivered here, so that however often they
+// change, widgets see at most one update per frame
+void DisplayManager::render_frame() {
+    TRACE_SCOPE("DisplayManager::render_frame");
+    frame_requested = false;
+    PipeScheduler::the().dispatch();
+    if (frame_handler) {
+        frame_handler();
+    }
+}
+
 }
@@ -0,0 +1,277 @@
+#include "gui.h"
+#include "../logging/logging.h"
+#include "../trace/trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace gui {
+
+DisplayServer::DisplayServer(const std::string socket_path, const style::Colour background) :
+        socket_path{socket_path}, fd{open_socket()}, epoll_fd{open_epoll()}, background{background} {
+    // Both screen buffers start out with undefined contents
+    damage(screen.get_back_buffer()->get_bounds());
+    previous_damage = pending_damage;
+}
+
+DisplayServer::~DisplayServer() {
+    for (const auto client_fd: client_fds) {
+        close(client_fd);
+    }
+    close(epoll_fd);
+    close(fd);
+    unlink(socket_path.c_str());
+}
+
+int DisplayServer::open_socket() const {
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw GUIException{"socket path is too long: " + socket_path};
+    }
+    socket_path.copy(addr.sun_path, socket_path.size());
+
+    const auto fd {socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+    if (fd < 0) {
+        throw GUIException{"failed to create socket", errno};
+    }
+
+    unlink(socket_path.c_str()); // Remove any stale socket left by a previous server
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        const auto err {errno};
+        close(fd);
+        throw GUIException{"failed to listen on " + socket_path, err};
+    }
+    return fd;
+}
+
+// The listening socket and every client are watched by an epoll instance of their own. Its fd is readable whenever
+// any of them is, so the whole server can be nested in another event loop as a single fd
+int DisplayServer::open_epoll() const {
+    const auto epoll_fd {epoll_create1(EPOLL_CLOEXEC)};
+    if (epoll_fd < 0) {
+        const auto err {errno};
+        close(fd);
+        throw GUIException{"failed to create epoll instance", err};
+    }
+
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        const auto err {errno};
+        close(epoll_fd);
+        close(fd);
+        throw GUIException{"failed to watch socket", err};
+    }
+    return epoll_fd;
+}
+
+// Accepts new clients and handles their pending messages, then composites if anything changed
+void DisplayServer::dispatch(const int timeout_ms) {
+    epoll_event ready[32];
+    const auto n {epoll_wait(epoll_fd, ready, 32, timeout_ms)};
+    if (n < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throw GUIException{"failed to poll clients", errno};
+    }
+
+    for (int i {0}; i < n; i++) {
+        const auto ready_fd {ready[i].data.fd};
+        if (ready_fd == fd) {
+            accept_clients();
+        } else if ((ready[i].events & (EPOLLHUP | EPOLLERR)) || !read_messages(ready_fd)) {
+            remove_client(ready_fd);
+        }
+    }
+
+    if (!pending_damage.empty()) {
+        composite();
+    }
+}
+
+void DisplayServer::accept_clients() {
+    int client_fd;
+    while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = client_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            LOG_ERROR("failed to watch client: " << std::strerror(errno));
+            close(client_fd);
+            continue;
+        }
+        client_fds.push_back(client_fd);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_ERROR("failed to accept client: " << std::strerror(errno));
+    }
+}
+
+// Returns false if the client has disconnected or misbehaved
+bool DisplayServer::read_messages(const int client_fd) {
+    while (true) {
+        Message msg;
+        iovec iov {&msg, sizeof(msg)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        msghdr hdr {};
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        const auto n {recvmsg(client_fd, &hdr, MSG_CMSG_CLOEXEC)};
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        } else if (n == 0) {
+            return false;
+        }
+
+        int passed_fd {-1};
+        for (auto cmsg {CMSG_FIRSTHDR(&hdr)}; cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                std::copy_n(CMSG_DATA(cmsg), sizeof(int), reinterpret_cast<unsigned char*>(&passed_fd));
+            }
+        }
+
+        if (n != sizeof(msg) || (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+            if (passed_fd >= 0) {
+                close(passed_fd);
+            }
+            LOG_WARNING("malformed message from client");
+            return false;
+        }
+
+        try {
+            handle_message(client_fd, msg, passed_fd);
+        } catch (const std::exception& e) {
+            LOG_ERROR("failed to handle client message: " << e.what());
+            return false;
+        }
+    }
+}
+
+void DisplayServer::handle_message(const int client_fd, const Message& msg, const int passed_fd) {
+    if (msg.type == MessageType::ATTACH) {
+        if (passed_fd < 0) {
+            throw GUIException{"attach without a buffer"};
+        }
+        if (find_surface(client_fd, msg.surface_id)) {
+            close(passed_fd);
+            throw GUIException{"surface #" + std::to_string(msg.surface_id) + " already exists"};
+        }
+        if (!drm::SharedMemBuffer::is_valid_layout(msg.width, msg.height, msg.stride)) {
+            close(passed_fd);
+            throw GUIException{"invalid buffer layout for surface #" + std::to_string(msg.surface_id)};
+        }
+
+        // The SharedMemBuffer takes ownership of passed_fd
+        auto buffer {std::make_unique<drm::SharedMemBuffer>(passed_fd, msg.width, msg.height, msg.stride)};
+        surfaces.push_back(Surface{client_fd, msg.surface_id, msg.x, msg.y, std::move(buffer)});
+        damage(surfaces.back().get_rect());
+        return;
+    }
+
+    if (passed_fd >= 0) {
+        close(passed_fd);
+    }
+
+    auto surface {find_surface(client_fd, msg.surface_id)};
+    if (!surface) {
+        throw GUIException{"no such surface #" + std::to_string(msg.surface_id)};
+    }
+
+    switch (msg.type) {
+    case MessageType::COMMIT: {
+        const auto count {std::min(msg.damage_count, max_damage_rects)};
+        for (uint32_t i {0}; i < count; i++) {
+            // Damage is in surface coordinates
+            const auto area {msg.damage[i].intersect(surface->buffer->get_bounds())};
+            damage(area.translate(surface->x, surface->y));
+        }
+        break;
+    }
+    case MessageType::MOVE:
+        damage(surface->get_rect());
+        surface->x = msg.x;
+        surface->y = msg.y;
+        damage(surface->get_rect());
+        break;
+    case MessageType::DESTROY: {
+        damage(surface->get_rect());
+        surfaces.erase(surfaces.begin() + (surface - surfaces.data()));
+        break;
+    }
+    default:
+        throw GUIException{"unknown message type"};
+    }
+}
+
+void DisplayServer::remove_client(const int client_fd) {
+    for (const auto& surface: surfaces) {
+        if (surface.client_fd == client_fd) {
+            damage(surface.get_rect());
+        }
+    }
+    surfaces.erase(std::remove_if(surfaces.begin(), surfaces.end(), [client_fd](const auto& surface) {
+        return surface.client_fd == client_fd;
+    }), surfaces.end());
+
+    client_fds.erase(std::remove(client_fds.begin(), client_fds.end(), client_fd), client_fds.end());
+    close(client_fd); // Also removes it from the epoll instance
+}
+
+DisplayServer::Surface* DisplayServer::find_surface(const int client_fd, const uint32_t id) {
+    for (auto& surface: surfaces) {
+        if (surface.client_fd == client_fd && surface.id == id) {
+            return &surface;
+        }
+    }
+    return nullptr;
+}
+
+void DisplayServer::damage(const drm::Rect& area) {
+    if (!area.is_empty()) {
+        pending_damage.push_back(area);
+    }
+}
+
+// Repaints only damaged areas. The back buffer last held the frame before the previous one, so it also needs the
+// areas damaged in the previous frame
+void DisplayServer::composite() {
+    TRACE_SCOPE("DisplayServer::composite");
+    auto& dst {*screen.get_back_buffer()};
+    const auto screen_bounds {dst.get_bounds()};
+
+    auto regions {pending_damage};
+    regions.insert(regions.end(), previous_damage.begin(), previous_damage.end());
+
+    for (const auto& region: regions) {
+        const auto area {region.intersect(screen_bounds)};
+        if (area.is_empty()) {
+            continue;
+        }
+
+        dst.fill(background, area);
+        for (const auto& surface: surfaces) {
+            const auto visible {surface.get_rect().intersect(area)};
+            if (!visible.is_empty()) {
+                surface.buffer->paint(dst, visible.translate(-surface.x, -surface.y), visible.x, visible.y, true);
+            }
+        }
+    }
+
+    screen.render();
+
+    previous_damage = std::move(pending_damage);
+    pending_damage.clear();
+}
+
+}
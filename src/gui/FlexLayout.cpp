@@ -0,0 +1,79 @@
+#include "gui.h"
+
+namespace gui {
+
+drm::Rect FlexLayout::make_rect(const uint32_t main_pos, const uint32_t cross_pos, const uint32_t main_len,
+        const uint32_t cross_len) const noexcept {
+    if (direction == Direction::ROW) {
+        return drm::Rect{static_cast<int32_t>(main_pos), static_cast<int32_t>(cross_pos), main_len, cross_len};
+    }
+    return drm::Rect{static_cast<int32_t>(cross_pos), static_cast<int32_t>(main_pos), cross_len, main_len};
+}
+
+Size FlexLayout::measure(Widget& container, const Constraints&) {
+    uint64_t total_main {0};
+    uint32_t max_cross {0};
+    uint32_t count {0};
+    for (const auto& child: container.get_children()) {
+        if (!child->is_visible()) {
+            continue;
+        }
+        const auto s {child->measure(Constraints{})};
+        total_main += main(s);
+        max_cross = std::max(max_cross, cross(s));
+        count++;
+    }
+    if (count > 0) {
+        total_main += uint64_t{spacing} * (count - 1);
+    }
+
+    const auto main_len {static_cast<uint32_t>(std::min<uint64_t>(total_main, Constraints::unbounded))};
+    return direction == Direction::ROW ? Size{main_len, max_cross} : Size{max_cross, main_len};
+}
+
+void FlexLayout::arrange(Widget& container, const Size size) {
+    // Measurements are cached, so measuring again here is cheap
+    int64_t spare {main(size)};
+    uint64_t total_grow {0};
+    uint32_t count {0};
+    for (const auto& child: container.get_children()) {
+        if (child->is_visible()) {
+            spare -= main(child->measure(Constraints{}));
+            total_grow += child->get_layout_params().grow;
+            count++;
+        }
+    }
+    if (count > 0) {
+        spare -= int64_t{spacing} * (count - 1);
+    }
+
+    uint64_t pos {0};
+    uint64_t grow_so_far {0};
+    for (const auto& child: container.get_children()) {
+        if (!child->is_visible()) {
+            continue;
+        }
+
+        const auto s {child->measure(Constraints{})};
+        uint32_t main_len {main(s)};
+        const auto grow {child->get_layout_params().grow};
+        if (spare > 0 && grow > 0) {
+            // Hand out whole pixels so that the shares always add up to the spare space exactly
+            main_len += spare * (grow_so_far + grow) / total_grow - spare * grow_so_far / total_grow;
+            grow_so_far += grow;
+        }
+
+        const uint32_t cross_len {alignment == Alignment::STRETCH ? cross(size) : std::min(cross(s), cross(size))};
+        uint32_t cross_pos {0};
+        if (alignment == Alignment::CENTER) {
+            cross_pos = (cross(size) - cross_len) / 2;
+        } else if (alignment == Alignment::END) {
+            cross_pos = cross(size) - cross_len;
+        }
+
+        child->place(make_rect(pos, cross_pos, main_len, cross_len));
+        pos += main_len + spacing;
+    }
+}
+
+}
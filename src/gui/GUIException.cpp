@@ -0,0 +1,11 @@
+#include "gui.h"
+#include <cstring>
+
+namespace gui {
+
+GUIException::GUIException(const std::string msg) noexcept : std::runtime_error(msg) {}
+
+GUIException::GUIException(const std::string msg, const int errnum) noexcept :
+        std::runtime_error(msg + ": " + std::strerror(errnum)) {}
+
+}
@@ -0,0 +1,136 @@
+#include "gui.h"
+#include <numeric>
+
+namespace gui {
+
+static Track get_track(const std::vector<Track>& tracks, const uint32_t i) noexcept {
+    return i < tracks.size() ? tracks[i] : Track::content();
+}
+
+static Constraints cell_constraints(const Track column, const Track row) noexcept {
+    Constraints c {};
+    if (column.kind == Track::Kind::PIXELS) {
+        c.min_w = c.max_w = column.value;
+    }
+    if (row.kind == Track::Kind::PIXELS) {
+        c.min_h = c.max_h = row.value;
+    }
+    return c;
+}
+
+// Shares the space left over by the other tracks out between the fractional ones, in proportion to their values
+static void distribute(const std::vector<Track>& tracks, const uint32_t available, const uint32_t spacing,
+        std::vector<uint32_t>& sizes) noexcept {
+    uint64_t used {uint64_t{spacing} * (sizes.size() - 1)};
+    uint64_t total_fraction {0};
+    for (uint32_t i {0}; i < sizes.size(); i++) {
+        const auto track {get_track(tracks, i)};
+        if (track.kind == Track::Kind::FRACTION) {
+            total_fraction += track.value;
+        } else {
+            used += sizes[i];
+        }
+    }
+    if (total_fraction == 0 || used >= available) {
+        return;
+    }
+
+    const uint64_t spare {available - used};
+    uint64_t fraction_so_far {0};
+    for (uint32_t i {0}; i < sizes.size(); i++) {
+        const auto track {get_track(tracks, i)};
+        if (track.kind == Track::Kind::FRACTION) {
+            sizes[i] = spare * (fraction_so_far + track.value) / total_fraction - spare * fraction_so_far / total_fraction;
+            fraction_so_far += track.value;
+        }
+    }
+}
+
+// Works out the size of every column and row. Content-sized (and, before distribution, fractional) tracks are as
+// big as their biggest child
+void GridLayout::size_tracks(Widget& container, const Size available, const bool distribute_spare,
+        std::vector<uint32_t>& column_sizes, std::vector<uint32_t>& row_sizes) const {
+    uint32_t column_count {static_cast<uint32_t>(columns.size())};
+    uint32_t row_count {static_cast<uint32_t>(rows.size())};
+    for (const auto& child: container.get_children()) {
+        if (child->is_visible()) {
+            column_count = std::max(column_count, child->get_layout_params().column + 1);
+            row_count = std::max(row_count, child->get_layout_params().row + 1);
+        }
+    }
+
+    column_sizes.assign(column_count, 0);
+    row_sizes.assign(row_count, 0);
+    for (uint32_t i {0}; i < column_count; i++) {
+        const auto track {get_track(columns, i)};
+        column_sizes[i] = track.kind == Track::Kind::PIXELS ? track.value : 0;
+    }
+    for (uint32_t i {0}; i < row_count; i++) {
+        const auto track {get_track(rows, i)};
+        row_sizes[i] = track.kind == Track::Kind::PIXELS ? track.value : 0;
+    }
+
+    // Every child is measured, even in fixed cells, so that they know they are relayout boundaries
+    for (const auto& child: container.get_children()) {
+        if (!child->is_visible()) {
+            continue;
+        }
+        const auto& params {child->get_layout_params()};
+        const auto column {get_track(columns, params.column)};
+        const auto row {get_track(rows, params.row)};
+        const auto s {child->measure(cell_constraints(column, row))};
+        if (column.kind != Track::Kind::PIXELS) {
+            column_sizes[params.column] = std::max(column_sizes[params.column], s.w);
+        }
+        if (row.kind != Track::Kind::PIXELS) {
+            row_sizes[params.row] = std::max(row_sizes[params.row], s.h);
+        }
+    }
+
+    if (distribute_spare) {
+        if (column_count > 0) {
+            distribute(columns, available.w, spacing, column_sizes);
+        }
+        if (row_count > 0) {
+            distribute(rows, available.h, spacing, row_sizes);
+        }
+    }
+}
+
+static uint32_t total_length(const std::vector<uint32_t>& sizes, const uint32_t spacing) noexcept {
+    if (sizes.empty()) {
+        return 0;
+    }
+    const uint64_t total {std::accumulate(sizes.begin(), sizes.end(), uint64_t{spacing} * (sizes.size() - 1))};
+    return static_cast<uint32_t>(std::min<uint64_t>(total, Constraints::unbounded));
+}
+
+Size GridLayout::measure(Widget& container, const Constraints&) {
+    std::vector<uint32_t> column_sizes, row_sizes;
+    size_tracks(container, Size{}, false, column_sizes, row_sizes);
+    return Size{total_length(column_sizes, spacing), total_length(row_sizes, spacing)};
+}
+
+void GridLayout::arrange(Widget& container, const Size size) {
+    std::vector<uint32_t> column_sizes, row_sizes;
+    size_tracks(container, size, true, column_sizes, row_sizes);
+
+    // Convert sizes to offsets
+    std::vector<int32_t> column_pos(column_sizes.size()), row_pos(row_sizes.size());
+    for (uint32_t i {1}; i < column_sizes.size(); i++) {
+        column_pos[i] = column_pos[i - 1] + column_sizes[i - 1] + spacing;
+    }
+    for (uint32_t i {1}; i < row_sizes.size(); i++) {
+        row_pos[i] = row_pos[i - 1] + row_sizes[i - 1] + spacing;
+    }
+
+    for (const auto& child: container.get_children()) {
+        if (child->is_visible()) {
+            const auto& params {child->get_layout_params()};
+            child->place(drm::Rect{column_pos[params.column], row_pos[params.row], column_sizes[params.column],
+                row_sizes[params.row]});
+        }
+    }
+}
+
+}
@@ -0,0 +1,23 @@
+#include "gui.h"
+
+namespace gui {
+
+Panel::Panel(const uint32_t width, const uint32_t height, const style::Colour colour) :
+        Widget{width, height}, colour{colour.to_int()} {}
+
+void Panel::set_colour(const style::Colour c) noexcept {
+    if (c.to_int() != colour) {
+        colour = c.to_int();
+        invalidate();
+    }
+}
+
+void Panel::draw(drm::Buffer& buffer) {
+    buffer.fill(style::Colour{colour});
+}
+
+void Panel::draw(drm::Bitmap& bitmap) {
+    bitmap.fill(style::Colour{colour});
+}
+
+}
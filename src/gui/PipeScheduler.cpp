@@ -0,0 +1,88 @@
+#include "gui.h"
+#include "../logging/logging.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace gui {
+
+PipeScheduler& PipeScheduler::the() {
+    static PipeScheduler instance {};
+    return instance;
+}
+
+// Queues a pipe for the next dispatch, unless it is already queued
+void PipeBase::schedule() noexcept {
+    if (!queued.exchange(true, std::memory_order_acq_rel)) {
+        scheduler.push(*this);
+    }
+}
+
+void PipeBase::cancel() noexcept {
+    if (queued.load(std::memory_order_acquire)) {
+        scheduler.remove(*this);
+    }
+}
+
+// Lock-free push onto the pending list. Each pipe is on the list at most once, so this can't suffer from ABA
+void PipeScheduler::push(PipeBase& pipe) noexcept {
+    auto head {pending.load(std::memory_order_relaxed)};
+    do {
+        pipe.next = head;
+    } while (!pending.compare_exchange_weak(head, &pipe, std::memory_order_release, std::memory_order_relaxed));
+
+    const auto fd {wakeup_fd.load(std::memory_order_relaxed)};
+    if (!head && fd >= 0) {
+        const uint64_t one {1};
+        // EAGAIN means the counter is saturated, in which case the wakeup is already pending
+        if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            LOG_ERROR("failed to signal wakeup eventfd: " << std::strerror(errno));
+        }
+    }
+}
+
+// Unlinks a pipe which is being destroyed, leaving the order of the others alone. Only called on the UI thread, which
+// is the only one that takes pipes off the pending list. Producers only ever change the head, so past it the list can
+// be edited in place; the head itself needs a compare-exchange in case another pipe is pushed in front of it
+void PipeScheduler::remove(PipeBase& pipe) noexcept {
+    for (auto link {&dispatching}; *link; link = &(*link)->next) {
+        if (*link == &pipe) {
+            *link = pipe.next;
+            return;
+        }
+    }
+
+    PipeBase* head {&pipe};
+    if (pending.compare_exchange_strong(head, pipe.next, std::memory_order_acquire)) {
+        return;
+    }
+    for (auto p {head}; p; p = p->next) {
+        if (p->next == &pipe) {
+            p->next = pipe.next;
+            return;
+        }
+    }
+}
+
+// Delivers the latest value of every pipe published to since the last dispatch, in the order they were first
+// published to. Call once per frame, before rendering
+void PipeScheduler::dispatch() {
+    // Reverse the list taken from the stack to get it in publishing order
+    auto p {pending.exchange(nullptr, std::memory_order_acquire)};
+    while (p) {
+        const auto next {p->next};
+        p->next = dispatching;
+        dispatching = p;
+        p = next;
+    }
+
+    while (dispatching) {
+        const auto pipe {dispatching};
+        dispatching = pipe->next;
+        // Clear the flag first so that a value published during delivery queues the pipe for the next dispatch
+        pipe->queued.store(false, std::memory_order_release);
+        pipe->deliver();
+    }
+}
+
+}
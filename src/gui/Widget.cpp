@@ -0,0 +1,317 @@
+#include "gui.h"
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace gui {
+
+Widget::Widget(const uint32_t width, const uint32_t height, const bool transparency) :
+        width{width}, height{height}, transparency{transparency},
+        cache{std::make_unique<drm::Bitmap>(width, height, transparency)}, preferred{width, height} {
+    damaged.push_back(get_rect());
+}
+
+void Widget::draw(drm::Buffer& buffer) {
+    buffer.fill(style::Colour::clear());
+}
+
+void Widget::draw(drm::Bitmap& bitmap) {
+    draw(*bitmap.get_back_buffer());
+}
+
+Size Widget::measure_content(const Constraints&) {
+    return preferred;
+}
+
+// Takes ownership of child, placing it above its siblings at (x, y) in this widget's coordinates
+Widget& Widget::add_child(std::unique_ptr<Widget> child, const int32_t x, const int32_t y) {
+    if (child->parent) {
+        throw GUIException{"widget already has a parent"};
+    }
+
+    if (!content) {
+        // The widget's own drawing has to be kept apart from its children so that it can be re-composited under them
+        content = std::make_unique<drm::Bitmap>(width, height, false);
+        content_dirty = true;
+    }
+
+    child->parent = this;
+    child->x = x;
+    child->y = y;
+    children.push_back(std::move(child));
+
+    auto& added {*children.back()};
+    if (added.visible) {
+        damage(added.get_rect());
+    }
+    request_layout();
+    return added;
+}
+
+std::unique_ptr<Widget> Widget::remove_child(Widget& child) {
+    const auto it {std::find_if(children.begin(), children.end(), [&](const auto& c) { return c.get() == &child; })};
+    if (it == children.end()) {
+        throw GUIException{"widget is not a child"};
+    }
+
+    if (child.visible) {
+        damage(child.get_rect());
+    }
+
+    auto removed {std::move(*it)};
+    children.erase(it);
+    removed->parent = nullptr;
+
+    if (children.empty()) {
+        content.reset();
+        content_dirty = true;
+    }
+    request_layout();
+    return removed;
+}
+
+// Moves the widget to the top of its siblings
+void Widget::raise() noexcept {
+    if (!parent) {
+        return;
+    }
+
+    auto& siblings {parent->children};
+    const auto it {std::find_if(siblings.begin(), siblings.end(), [&](const auto& c) { return c.get() == this; })};
+    std::rotate(it, it + 1, siblings.end());
+    if (visible) {
+        parent->damage(get_rect());
+    }
+    parent->child_layout_changed();
+}
+
+// Moving only re-composites the parent; the widget's cached bitmap is reused as is
+void Widget::move(const int32_t x, const int32_t y) noexcept {
+    if (parent && visible) {
+        parent->damage(get_rect());
+    }
+    this->x = x;
+    this->y = y;
+    if (parent && visible) {
+        parent->damage(get_rect());
+    }
+}
+
+// Sets the widget's size. If the parent has a Layout, this is only the size the widget asks for, and the Layout
+// decides
+void Widget::resize(const uint32_t width, const uint32_t height) {
+    preferred = Size{width, height};
+    if (!parent || !parent->layout_manager) {
+        set_size(width, height);
+    }
+    request_layout();
+}
+
+void Widget::set_size(const uint32_t width, const uint32_t height) {
+    if (width == this->width && height == this->height) {
+        return;
+    }
+
+    if (parent && visible) {
+        parent->damage(get_rect());
+    }
+
+    cache = std::make_unique<drm::Bitmap>(width, height, transparency);
+    if (content) {
+        content = std::make_unique<drm::Bitmap>(width, height, false);
+    }
+    this->width = width;
+    this->height = height;
+    arrange_dirty = true;
+    invalidate();
+}
+
+void Widget::set_visible(const bool visible) noexcept {
+    if (visible == this->visible) {
+        return;
+    }
+
+    this->visible = visible;
+    if (parent) {
+        parent->damage(get_rect());
+        parent->child_layout_changed();
+    }
+}
+
+void Widget::set_layout(std::unique_ptr<Layout> layout) noexcept {
+    layout_manager = std::move(layout);
+    request_layout();
+}
+
+void Widget::set_layout_params(const LayoutParams& params) noexcept {
+    layout_params = params;
+    if (parent) {
+        parent->child_layout_changed();
+    }
+}
+
+// Marks the widget's own content as needing to be redrawn
+void Widget::invalidate() noexcept {
+    invalidate(drm::Rect{0, 0, width, height});
+}
+
+// As above, but only the given area (in the widget's coordinates) is expected to look any different afterwards
+void Widget::invalidate(const drm::Rect& area) noexcept {
+    content_dirty = true;
+    damage(area);
+}
+
+// Marks the widget as needing to be measured and laid out again, e.g. because its content now needs more space
+void Widget::request_layout() noexcept {
+    measure_dirty = true;
+    arrange_dirty = true;
+    mark_for_layout();
+    notify_parent();
+}
+
+// A child's measurement or layout parameters have changed, so the children need arranging again, and this widget's
+// own measurement may have changed with them
+void Widget::child_layout_changed() noexcept {
+    measure_dirty = true;
+    arrange_dirty = true;
+    mark_for_layout();
+    notify_parent();
+}
+
+// Passes a change in this widget's measurement on to its parent, unless this is a relayout boundary: the parent has
+// no Layout to use the measurement, or the widget was last measured with tight constraints so its size can't change
+void Widget::notify_parent() noexcept {
+    if (parent && parent->layout_manager && !measured_for.is_tight()) {
+        parent->child_layout_changed();
+    }
+}
+
+// Makes sure the next layout pass reaches this widget
+void Widget::mark_for_layout() noexcept {
+    for (auto ancestor {parent}; ancestor && !ancestor->descendant_dirty; ancestor = ancestor->parent) {
+        ancestor->descendant_dirty = true;
+    }
+}
+
+// Returns the size the widget wants given the constraints. The result is cached until the widget requests layout
+Size Widget::measure(const Constraints& c) {
+    if (measure_dirty || !(c == measured_for)) {
+        measured = c.constrain(layout_manager ? layout_manager->measure(*this, c) : measure_content(c));
+        measured_for = c;
+        measure_dirty = false;
+    }
+    return measured;
+}
+
+// Called by the parent's Layout to give the widget its position and size, then lays out its own children if needed
+void Widget::place(const drm::Rect& frame) {
+    if (frame.x != x || frame.y != y) {
+        move(frame.x, frame.y);
+    }
+    set_size(frame.w, frame.h);
+    layout();
+}
+
+// Lays out every part of the tree that has changed since the last pass. Children of a widget without a Layout keep
+// the positions and sizes they were given
+void Widget::layout() {
+    if (arrange_dirty) {
+        arrange_dirty = false;
+        if (layout_manager) {
+            layout_manager->arrange(*this, Size{width, height});
+        } else {
+            for (const auto& child: children) {
+                child->layout();
+            }
+        }
+    } else if (descendant_dirty) {
+        for (const auto& child: children) {
+            child->layout();
+        }
+    }
+    descendant_dirty = false;
+}
+
+// Records that an area of this widget's cache must be rebuilt. The same area of every ancestor's cache is then stale
+// too, so the damage is passed up the tree
+void Widget::damage(const drm::Rect& area) noexcept {
+    const auto clipped {area.intersect(drm::Rect{0, 0, width, height})};
+    if (clipped.is_empty()) {
+        return;
+    }
+
+    subtree_dirty = true;
+    if (damaged.size() < max_damage_rects) {
+        damaged.push_back(clipped);
+    } else {
+        damaged.front() = std::accumulate(damaged.begin(), damaged.end(), clipped,
+            [](const drm::Rect& a, const drm::Rect& b) { return a.unite(b); });
+        damaged.resize(1);
+    }
+
+    if (parent && visible) {
+        parent->damage(clipped.translate(x, y));
+    }
+}
+
+// Brings the cached bitmaps of this widget and any invalidated descendants up to date. Clean subtrees are skipped
+// entirely. Returns the areas of this widget that changed
+std::vector<drm::Rect> Widget::update() {
+    if (!subtree_dirty) {
+        return {};
+    }
+
+    for (const auto& child: children) {
+        if (child->visible) {
+            child->update();
+        }
+    }
+
+    if (content_dirty) {
+        draw(*(content ? content : cache));
+        content_dirty = false;
+    }
+
+    if (content) {
+        for (const auto& area: damaged) {
+            recomposite(area);
+        }
+    }
+
+    subtree_dirty = false;
+    return std::exchange(damaged, {});
+}
+
+// Rebuilds an area of the cache from the widget's own content and the cached bitmaps of the children over it
+void Widget::recomposite(const drm::Rect& area) const noexcept {
+    auto& dst {*cache->get_back_buffer()};
+    content->composite(dst, area, area.x, area.y);
+
+    for (const auto& child: children) {
+        if (!child->visible) {
+            continue;
+        }
+        const auto overlap {area.intersect(child->get_rect())};
+        if (!overlap.is_empty()) {
+            child->cache->composite(dst, overlap.translate(-child->x, -child->y), overlap.x, overlap.y);
+        }
+    }
+}
+
+// Lays out and updates the tree, then copies the changed parts of this widget to (x, y) in dst, or all of it if full is set (e.g.
+// because dst's previous contents are unknown). Returns the areas of dst that were painted
+std::vector<drm::Rect> Widget::render(drm::Buffer& dst, const int32_t x, const int32_t y, const bool full) {
+    layout();
+    auto areas {update()};
+    if (full) {
+        areas = {drm::Rect{0, 0, width, height}};
+    }
+
+    for (auto& area: areas) {
+        cache->composite(dst, area, x + area.x, y + area.y, false);
+        area = area.translate(x, y);
+    }
+    return areas;
+}
+
+}
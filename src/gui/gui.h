@@ -1,20 +1,524 @@
 #include "../drm/drm.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <queue>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 #ifndef GUI_H
 #define GUI_H
 
 namespace gui {
 
+class DisplayServer;
+
+// Events are dispatched in priority order, so that input is never stuck behind background work
+enum class EventPriority {
+    INPUT, DISPLAY, TIMER, IDLE
+};
+
+// DisplayManager owns the DRM card and the event loop. The loop sleeps in epoll until a watched fd (the DRM card's
+// page-flip events, the kernel's hotplug events, input devices, timers, pipes with new values or user fds) is ready,
+// then dispatches the ready events through a priority queue. Frames are only rendered when one has been requested,
+// and at most once per vblank
 class DisplayManager {
 public:
+    using FDCallback = std::function<void(const uint32_t events)>;
+
     DisplayManager(const std::string drm_card_path);
+    DisplayManager(const DisplayManager&) = delete;
+    DisplayManager& operator=(const DisplayManager&) = delete;
+    ~DisplayManager();
     static DisplayManager& the();
     drm::DRMCard& get_drm_card() noexcept;
+    DisplayServer& serve(const std::string socket_path);
+
+    uint64_t add_fd(const int fd, const uint32_t events, const EventPriority priority, FDCallback callback);
+    void remove_fd(const uint64_t id) noexcept;
+    uint64_t add_timer(const std::chrono::nanoseconds interval, const bool repeat, std::function<void()> callback,
+        const EventPriority priority = EventPriority::TIMER);
+    void cancel_timer(const uint64_t id) noexcept { remove_fd(id); };
+    void post(std::function<void()> task, const EventPriority priority = EventPriority::IDLE);
+    void set_frame_handler(std::function<void()> handler) noexcept { frame_handler = std::move(handler); };
+    void request_frame() noexcept { frame_requested = true; };
+    void flip_queued(drm::ScreenBitmap& screen);
+    void vblank_occurred(const std::chrono::steady_clock::time_point time) noexcept { last_vblank = time; };
+    std::chrono::steady_clock::time_point predict_vblank(const std::chrono::steady_clock::time_point after);
+    std::chrono::nanoseconds get_frame_interval();
+    void run();
+    void quit() noexcept { running = false; };
 
 private:
+    struct Watch {
+        int fd;
+        bool owned; // Closed when removed
+        EventPriority priority;
+        std::shared_ptr<FDCallback> callback;
+    };
+
+    struct Event {
+        EventPriority priority;
+        uint64_t sequence; // Keeps events of the same priority in order
+        std::function<void()> callback;
+
+        bool operator<(const Event& other) const noexcept {
+            // std::priority_queue pops the greatest element first
+            return priority != other.priority ? priority > other.priority : sequence > other.sequence;
+        }
+    };
+
+    int create_epoll() const;
+    int create_wakeup() const;
+    int create_uevent_socket() const noexcept;
+    uint64_t add_watch(const int fd, const bool owned, const uint32_t events, const EventPriority priority,
+        FDCallback callback);
+    void wait_for_events(const int timeout_ms);
+    void dispatch_events();
+    void handle_drm_events();
+    void handle_uevents(const int fd);
+    void render_frame();
+
     drm::DRMCard card;
+    const std::string card_name; // As the kernel names it in uevents, e.g. dri/card0
+    const int epoll_fd;
+    const int wakeup_fd; // Signalled by PipeScheduler when a pipe has a new value
+    std::unique_ptr<DisplayServer> server {};
+    std::map<uint64_t, Watch> watches {};
+    uint64_t next_id {1};
+    uint64_t next_sequence {0};
+    std::priority_queue<Event> events {};
+    std::vector<drm::ScreenBitmap*> flipping {}; // Screens with a page flip pending
+    std::function<void()> frame_handler {};
+    std::chrono::steady_clock::time_point last_vblank {}; // Taken from page-flip events
+    std::chrono::nanoseconds frame_interval {0}; // Read from the current mode on first use
+    bool frame_requested {false};
+    bool running {false};
+};
+
+class GUIException : public std::runtime_error {
+public:
+    GUIException(const std::string msg) noexcept;
+    GUIException(const std::string msg, const int errnum) noexcept;
+};
+
+// Messages exchanged between DisplayClient and DisplayServer over a SOCK_SEQPACKET socket. Pixels never cross the
+// socket: ATTACH passes a sealed memfd as SCM_RIGHTS ancillary data, and COMMIT only says which parts of it changed
+enum class MessageType : uint32_t {
+    ATTACH, COMMIT, MOVE, DESTROY
+};
+
+constexpr uint32_t max_damage_rects {16};
+
+struct Message {
+    MessageType type;
+    uint32_t surface_id;
+    int32_t x, y;
+    uint32_t width, height, stride;
+    uint32_t damage_count;
+    drm::Rect damage[max_damage_rects];
+};
+
+class PipeScheduler;
+
+// PipeBase is the type-independent part of a Pipe, which lets the scheduler queue pipes of any type
+class PipeBase {
+public:
+    PipeBase(PipeScheduler& scheduler) noexcept : scheduler{scheduler} {};
+    PipeBase(const PipeBase&) = delete;
+    PipeBase& operator=(const PipeBase&) = delete;
+    virtual ~PipeBase() {};
+protected:
+    void schedule() noexcept;
+    void cancel() noexcept;
+
+    PipeScheduler& scheduler;
+private:
+    friend class PipeScheduler;
+
+    // Passes the latest value, if there is a new one, to the sink
+    virtual void deliver() = 0;
+
+    std::atomic<bool> queued {false};
+    PipeBase* next {nullptr}; // Intrusive link in the scheduler's pending list
+};
+
+// PipeScheduler collects pipes with new values and delivers them together once per frame, so values can arrive far
+// faster than the display refreshes without any events piling up. Pipes are queued lock-free from any thread, at
+// most once between deliveries; dispatch() must be called from the UI thread. If a wakeup eventfd is set, it is
+// signalled whenever the first pipe is queued, so an event loop can sleep until there is something to deliver
+class PipeScheduler {
+public:
+    PipeScheduler() noexcept {};
+    PipeScheduler(const PipeScheduler&) = delete;
+    PipeScheduler& operator=(const PipeScheduler&) = delete;
+    static PipeScheduler& the();
+    void set_wakeup_fd(const int fd) noexcept { wakeup_fd = fd; };
+    void dispatch();
+private:
+    friend class PipeBase;
+
+    void push(PipeBase& pipe) noexcept;
+    void remove(PipeBase& pipe) noexcept;
+
+    std::atomic<PipeBase*> pending {nullptr};
+    PipeBase* dispatching {nullptr}; // Pipes taken from pending but not yet delivered
+    std::atomic<int> wakeup_fd {-1}; // eventfd written when the pending list stops being empty
+};
+
+// Pipe carries values of type T from a producer, which may be on any thread, to a sink on the UI thread. Values are
+// passed through a triple buffer, so publishing is wait-free and a burst of values coalesces to the latest one. The
+// sink is called at most once per PipeScheduler::dispatch(). There must only be one producer thread at a time, and
+// the pipe must be destroyed on the UI thread after its producer has stopped publishing: a publish racing with the
+// destructor could queue the pipe again once it has been unlinked
+template <typename T>
+class Pipe : public PipeBase {
+public:
+    using Sink = std::function<void(const T&)>;
+
+    Pipe(Sink sink, PipeScheduler& scheduler = PipeScheduler::the()) : PipeBase{scheduler}, sink{std::move(sink)} {};
+    ~Pipe() { cancel(); };
+    void publish(T value);
+private:
+    static constexpr uint8_t index_mask {0x3};
+    static constexpr uint8_t fresh {0x4}; // Set in state when the middle slot holds a value not yet delivered
+
+    void deliver() override;
+
+    std::array<T, 3> slots {};
+    uint8_t back {0}; // Only touched by the producer
+    uint8_t front {1}; // Only touched by the UI thread
+    std::atomic<uint8_t> state {2}; // Index of the middle slot, plus the fresh flag
+    const Sink sink;
+};
+
+// Writes the value into the producer's own slot, then swaps that slot into the middle, replacing any value which
+// hasn't been delivered yet
+template <typename T>
+void Pipe<T>::publish(T value) {
+    slots[back] = std::move(value);
+    back = state.exchange(back | fresh, std::memory_order_acq_rel) & index_mask;
+    schedule();
+}
+
+template <typename T>
+void Pipe<T>::deliver() {
+    if (!(state.load(std::memory_order_acquire) & fresh)) {
+        return;
+    }
+    front = state.exchange(front, std::memory_order_acq_rel) & index_mask;
+    sink(slots[front]);
+}
+
+struct Size {
+    uint32_t w {0}, h {0};
+
+    bool operator==(const Size& other) const noexcept { return w == other.w && h == other.h; };
+    bool operator!=(const Size& other) const noexcept { return !(*this == other); };
+};
+
+// Constraints bound the size a widget may take when it is measured by its parent's layout
+struct Constraints {
+    static constexpr uint32_t unbounded {std::numeric_limits<uint32_t>::max()};
+
+    uint32_t min_w {0}, max_w {unbounded};
+    uint32_t min_h {0}, max_h {unbounded};
+
+    static Constraints tight(const Size s) noexcept { return Constraints{s.w, s.w, s.h, s.h}; };
+    bool is_tight() const noexcept { return min_w == max_w && min_h == max_h; };
+    Size constrain(const Size s) const noexcept {
+        return Size{std::clamp(s.w, min_w, std::max(min_w, max_w)), std::clamp(s.h, min_h, std::max(min_h, max_h))};
+    };
+    bool operator==(const Constraints& other) const noexcept {
+        return min_w == other.min_w && max_w == other.max_w && min_h == other.min_h && max_h == other.max_h;
+    };
+};
+
+// LayoutParams describe how a widget wants to be placed by its parent's layout
+struct LayoutParams {
+    uint32_t grow {0}; // FlexLayout: share of any spare space along the main axis
+    uint32_t row {0}, column {0}; // GridLayout: cell
+};
+
+class Widget;
+
+// Layout positions and sizes a container's visible children. Layouts are only asked to measure or arrange when
+// something affecting the result has changed
+class Layout {
+public:
+    virtual ~Layout() {};
+    // Returns the size the container would like to be, given the constraints
+    virtual Size measure(Widget& container, const Constraints& c) = 0;
+    // Places every visible child within a container of the given size
+    virtual void arrange(Widget& container, const Size size) = 0;
+};
+
+enum class Direction {
+    ROW, COLUMN
+};
+
+enum class Alignment {
+    START, CENTER, END, STRETCH
+};
+
+// FlexLayout lines children up in a row or column, sharing out any spare space between those with a grow factor.
+// Children are measured at their natural size, so a child's cached measurement stays valid however its siblings
+// change
+// TODO: shrink children when there isn't enough space, and wrap onto multiple lines
+class FlexLayout : public Layout {
+public:
+    FlexLayout(const Direction direction = Direction::ROW, const uint32_t spacing = 0,
+        const Alignment alignment = Alignment::START) noexcept :
+        direction{direction}, spacing{spacing}, alignment{alignment} {};
+    Size measure(Widget& container, const Constraints& c) override;
+    void arrange(Widget& container, const Size size) override;
+private:
+    uint32_t main(const Size s) const noexcept { return direction == Direction::ROW ? s.w : s.h; };
+    uint32_t cross(const Size s) const noexcept { return direction == Direction::ROW ? s.h : s.w; };
+    drm::Rect make_rect(const uint32_t main_pos, const uint32_t cross_pos, const uint32_t main_len,
+        const uint32_t cross_len) const noexcept;
+
+    const Direction direction;
+    const uint32_t spacing;
+    const Alignment alignment;
+};
+
+// Track is the size rule for a grid row or column: a fixed number of pixels, the size of its largest child, or a
+// share of whatever space is left after the other tracks
+struct Track {
+    enum class Kind {
+        PIXELS, CONTENT, FRACTION
+    };
+
+    Kind kind;
+    uint32_t value;
+
+    static constexpr Track pixels(const uint32_t n) { return Track{Kind::PIXELS, n}; };
+    static constexpr Track content() { return Track{Kind::CONTENT, 0}; };
+    static constexpr Track fraction(const uint32_t n = 1) { return Track{Kind::FRACTION, n}; };
+};
+
+// GridLayout places each child in the cell given by its LayoutParams, stretched to fill it. Rows and columns beyond
+// those given are sized to their content. Children in fixed-size cells are measured with tight constraints, so
+// changes inside them never cause the grid itself to be relaid out
+class GridLayout : public Layout {
+public:
+    GridLayout(const std::vector<Track> columns, const std::vector<Track> rows = {}, const uint32_t spacing = 0) :
+        columns{columns}, rows{rows}, spacing{spacing} {};
+    Size measure(Widget& container, const Constraints& c) override;
+    void arrange(Widget& container, const Size size) override;
+private:
+    void size_tracks(Widget& container, const Size available, const bool distribute, std::vector<uint32_t>& column_sizes,
+        std::vector<uint32_t>& row_sizes) const;
+
+    const std::vector<Track> columns;
+    const std::vector<Track> rows;
+    const uint32_t spacing;
+};
+
+// Widget is a node in the retained widget tree. Each widget caches its rendered output, including its children, in a
+// Bitmap. Changing a widget only redraws that widget; its ancestors then re-composite the cached bitmaps in the
+// damaged area rather than repainting their whole subtrees, so frame cost depends on what changed, not tree size.
+// Layout is incremental too: measured sizes are cached per widget, and request_layout() only dirties the ancestors
+// whose size could depend on the change. It stops at relayout boundaries: widgets whose size is fixed by their parent
+// regardless of their content, and widgets whose parent has no Layout. A plain Widget is a transparent container
+class Widget {
+public:
+    Widget(const uint32_t width, const uint32_t height, const bool transparency = true);
+    Widget(const Widget&) = delete;
+    Widget& operator=(const Widget&) = delete;
+    virtual ~Widget() {};
+    Widget* get_parent() const noexcept { return parent; };
+    const std::vector<std::unique_ptr<Widget>>& get_children() const noexcept { return children; };
+    drm::Rect get_rect() const noexcept { return drm::Rect{x, y, width, height}; }; // In the parent's coordinates
+    bool is_visible() const noexcept { return visible; };
+    Widget& add_child(std::unique_ptr<Widget> child, const int32_t x, const int32_t y);
+    std::unique_ptr<Widget> remove_child(Widget& child);
+    void raise() noexcept;
+    void move(const int32_t x, const int32_t y) noexcept;
+    void resize(const uint32_t width, const uint32_t height);
+    void set_visible(const bool visible) noexcept;
+    void set_layout(std::unique_ptr<Layout> layout) noexcept;
+    const LayoutParams& get_layout_params() const noexcept { return layout_params; };
+    void set_layout_params(const LayoutParams& params) noexcept;
+    void invalidate() noexcept;
+    void invalidate(const drm::Rect& area) noexcept;
+    void request_layout() noexcept;
+    Size measure(const Constraints& c);
+    void place(const drm::Rect& frame);
+    void layout();
+    std::vector<drm::Rect> update();
+    std::vector<drm::Rect> render(drm::Buffer& dst, const int32_t x, const int32_t y, const bool full = false);
+protected:
+    // Draws the widget's own content, excluding children, onto a buffer of the widget's size. Called only when the
+    // widget has been invalidated
+    virtual void draw(drm::Buffer& buffer);
+    // Draws the widget's own content into its bitmap. Widgets whose content is a single colour can override this to
+    // fill the bitmap, which then needs no pixel storage. Defaults to draw() on the bitmap's buffer
+    virtual void draw(drm::Bitmap& bitmap);
+    // Returns the size the widget's own content needs, for widgets without a Layout. Defaults to the size the widget
+    // was created or last resized with. Call request_layout() when the answer changes
+    virtual Size measure_content(const Constraints& c);
+private:
+    static constexpr size_t max_damage_rects {8}; // More than this are merged into their bounding box
+
+    void damage(const drm::Rect& area) noexcept;
+    void recomposite(const drm::Rect& area) const noexcept;
+    void set_size(const uint32_t width, const uint32_t height);
+    void child_layout_changed() noexcept;
+    void notify_parent() noexcept;
+    void mark_for_layout() noexcept;
+
+    Widget* parent {nullptr};
+    std::vector<std::unique_ptr<Widget>> children {}; // In stacking order, bottom first
+    int32_t x {0}, y {0};
+    uint32_t width, height;
+    const bool transparency;
+    bool visible {true};
+    bool content_dirty {true};
+    bool subtree_dirty {true};
+    std::unique_ptr<drm::Bitmap> cache;
+    std::unique_ptr<drm::Bitmap> content {}; // Only needed once the widget has children; otherwise drawn into cache
+    std::vector<drm::Rect> damaged {};
+    std::unique_ptr<Layout> layout_manager {};
+    LayoutParams layout_params {};
+    Size preferred;
+    Constraints measured_for {};
+    Size measured {};
+    bool measure_dirty {true}; // The cached measurement is stale
+    bool arrange_dirty {true}; // Children need to be placed again
+    bool descendant_dirty {false}; // Some descendant needs to be laid out
+};
+
+// Panel is a widget filled with a solid colour
+class Panel : public Widget {
+public:
+    Panel(const uint32_t width, const uint32_t height, const style::Colour colour);
+    void set_colour(const style::Colour c) noexcept;
+protected:
+    void draw(drm::Buffer& buffer) override;
+    void draw(drm::Bitmap& bitmap) override;
+private:
+    uint32_t colour; // Premultiplied ARGB
+};
+
+// Output is a widget which displays a value of type T. Its pipe lets producers on other threads update the value at
+// any rate; the widget is redrawn at most once per frame, with the latest value
+template <typename T>
+class Output : public Widget {
+public:
+    Output(const uint32_t width, const uint32_t height, const T& initial = T{}) :
+        Widget{width, height}, value{initial}, pipe{[this](const T& v) { set_value(v); }} {};
+    const T& get_value() const noexcept { return value; };
+    void set_value(const T& v);
+    Pipe<T>& get_pipe() noexcept { return pipe; };
+protected:
+    // Called when the value changes; by default just redraws the widget
+    virtual void value_changed() { invalidate(); };
+private:
+    T value;
+    Pipe<T> pipe;
+};
+
+template <typename T>
+void Output<T>::set_value(const T& v) {
+    value = v;
+    value_changed();
+}
+
+// Input is a widget whose value is changed by the user, and which publishes every change into its connected pipes,
+// e.g. those of Output widgets. Connected pipes must outlive the connection
+template <typename T>
+class Input : public Widget {
+public:
+    Input(const uint32_t width, const uint32_t height, const T& initial = T{}) : Widget{width, height}, value{initial} {};
+    const T& get_value() const noexcept { return value; };
+    void connect(Pipe<T>& pipe) { pipes.push_back(&pipe); };
+    void disconnect(Pipe<T>& pipe) { pipes.erase(std::remove(pipes.begin(), pipes.end(), &pipe), pipes.end()); };
+protected:
+    // For subclasses to call when the user changes the value
+    void set_value(const T& v);
+private:
+    T value;
+    std::vector<Pipe<T>*> pipes {};
+};
+
+template <typename T>
+void Input<T>::set_value(const T& v) {
+    value = v;
+    invalidate();
+    for (const auto pipe: pipes) {
+        pipe->publish(v);
+    }
+}
+
+// DisplayServer composites surfaces shared by client processes onto the screen
+class DisplayServer {
+public:
+    DisplayServer(const std::string socket_path, const style::Colour background = style::Colour::black());
+    DisplayServer(const DisplayServer&) = delete;
+    DisplayServer& operator=(const DisplayServer&) = delete;
+    ~DisplayServer();
+    int get_fd() const noexcept { return epoll_fd; }; // Readable when dispatch() has something to do
+    void dispatch(const int timeout_ms);
+private:
+    struct Surface {
+        int client_fd;
+        uint32_t id;
+        int32_t x, y;
+        std::unique_ptr<drm::SharedMemBuffer> buffer;
+
+        drm::Rect get_rect() const noexcept { return drm::Rect{x, y, buffer->get_width(), buffer->get_height()}; };
+    };
+
+    int open_socket() const;
+    int open_epoll() const;
+    void accept_clients();
+    bool read_messages(const int client_fd);
+    void handle_message(const int client_fd, const Message& msg, const int passed_fd);
+    void remove_client(const int client_fd);
+    Surface* find_surface(const int client_fd, const uint32_t id);
+    void damage(const drm::Rect& area);
+    void composite();
+
+    const std::string socket_path;
+    const int fd;
+    const int epoll_fd;
+    const style::Colour background;
+    drm::ScreenBitmap screen {};
+    std::vector<int> client_fds {};
+    std::vector<Surface> surfaces {}; // In stacking order, bottom first
+    std::vector<drm::Rect> pending_damage {};
+    std::vector<drm::Rect> previous_damage {}; // Not yet repainted in the current back buffer
+};
+
+// DisplayClient lets a process draw into memfd-backed surfaces which a DisplayServer composites
+class DisplayClient {
+public:
+    DisplayClient(const std::string socket_path);
+    DisplayClient(const DisplayClient&) = delete;
+    DisplayClient& operator=(const DisplayClient&) = delete;
+    ~DisplayClient();
+    uint32_t create_surface(const uint32_t width, const uint32_t height, const int32_t x, const int32_t y);
+    drm::Buffer& get_surface_buffer(const uint32_t id) { return *surfaces.at(id); };
+    void commit(const uint32_t id, const std::vector<drm::Rect>& damage) const;
+    void commit(const uint32_t id) const;
+    void move_surface(const uint32_t id, const int32_t x, const int32_t y) const;
+    void destroy_surface(const uint32_t id);
+private:
+    int connect_socket(const std::string& path) const;
+    void send(const Message& msg, const int passed_fd = -1) const;
 
+    const int fd;
+    uint32_t next_id {1};
+    std::map<uint32_t, std::unique_ptr<drm::SharedMemBuffer>> surfaces {};
 };
 
 }
@@ -0,0 +1,151 @@
+#include "image.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <vector>
+#include <png.h>
+
+namespace image {
+
+std::unique_ptr<drm::MemBuffer> load(const std::string& path) {
+    std::ifstream file {path, std::ios::binary};
+    if (!file) {
+        throw ImageException{"failed to open image " + path};
+    }
+
+    const std::vector<uint8_t> data {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    if (file.bad()) {
+        throw ImageException{"failed to read image " + path};
+    }
+
+    try {
+        return decode(data.data(), data.size());
+    } catch (const ImageException& e) {
+        throw ImageException{path + ": " + e.what()};
+    }
+}
+
+std::unique_ptr<drm::MemBuffer> decode(const uint8_t* data, const size_t size) {
+    if (size >= 8 && png_sig_cmp(data, 0, 8) == 0) {
+        return decode_png(data, size);
+    } else if (size >= 4 && std::memcmp(data, "qoif", 4) == 0) {
+        return decode_qoi(data, size);
+    }
+    throw ImageException{"unrecognised image format"};
+}
+
+// Buffer sizes are 32-bit, so larger images can't be represented
+static void check_dimensions(const uint32_t w, const uint32_t h) {
+    if (w == 0 || h == 0 || uint64_t{w} * h * 4 > std::numeric_limits<uint32_t>::max()) {
+        throw ImageException{"invalid image dimensions " + std::to_string(w) + "x" + std::to_string(h)};
+    }
+}
+
+// libpng expands every colour type and bit depth to 8-bit RGBA, which is then premultiplied in place
+std::unique_ptr<drm::MemBuffer> decode_png(const uint8_t* data, const size_t size) {
+    png_image png {};
+    png.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&png, data, size)) {
+        throw ImageException{std::string{"failed to read PNG: "} + png.message};
+    }
+
+    png.format = PNG_FORMAT_RGBA;
+    try {
+        check_dimensions(png.width, png.height);
+    } catch (...) {
+        png_image_free(&png);
+        throw;
+    }
+
+    auto img {std::make_unique<drm::MemBuffer>(png.width, png.height, 32)};
+    if (!png_image_finish_read(&png, nullptr, img->get_buffer(), img->get_stride(), nullptr)) {
+        throw ImageException{std::string{"failed to decode PNG: "} + png.message};
+    }
+
+    premultiply(img->get_buffer(), img->get_buffer(), size_t{png.width} * png.height);
+    return img;
+}
+
+static uint32_t read_be32(const uint8_t* p) noexcept {
+    return uint32_t{p[0]} << 24 | uint32_t{p[1]} << 16 | uint32_t{p[2]} << 8 | p[3];
+}
+
+// QOI (https://qoiformat.org) decodes much faster than PNG, at a similar size for UI assets
+std::unique_ptr<drm::MemBuffer> decode_qoi(const uint8_t* data, const size_t size) {
+    constexpr size_t header_size {14};
+    constexpr size_t end_marker_size {8};
+    if (size < header_size + end_marker_size || std::memcmp(data, "qoif", 4) != 0) {
+        throw ImageException{"invalid QOI header"};
+    }
+
+    const uint32_t w {read_be32(data + 4)}, h {read_be32(data + 8)};
+    check_dimensions(w, h);
+
+    auto img {std::make_unique<drm::MemBuffer>(w, h, 32)};
+    uint8_t* out {img->get_buffer()};
+    const size_t n {size_t{w} * h};
+
+    uint8_t seen[64][4] {};
+    uint8_t px[4] {0, 0, 0, 0xFF}; // R, G, B, A
+    const uint8_t* p {data + header_size};
+    const uint8_t* const end {data + size - end_marker_size};
+
+    for (size_t i {0}; i < n;) {
+        if (p >= end) {
+            throw ImageException{"truncated QOI data"};
+        }
+
+        const uint8_t op {*p++};
+        uint32_t run {1};
+        if (op == 0xFE) { // QOI_OP_RGB
+            if (end - p < 3) {
+                throw ImageException{"truncated QOI data"};
+            }
+            px[0] = p[0], px[1] = p[1], px[2] = p[2];
+            p += 3;
+        } else if (op == 0xFF) { // QOI_OP_RGBA
+            if (end - p < 4) {
+                throw ImageException{"truncated QOI data"};
+            }
+            std::memcpy(px, p, 4);
+            p += 4;
+        } else {
+            switch (op >> 6) {
+                case 0: // QOI_OP_INDEX
+                    std::memcpy(px, seen[op & 0x3F], 4);
+                    break;
+                case 1: // QOI_OP_DIFF
+                    px[0] += ((op >> 4) & 0x03) - 2;
+                    px[1] += ((op >> 2) & 0x03) - 2;
+                    px[2] += (op & 0x03) - 2;
+                    break;
+                case 2: { // QOI_OP_LUMA
+                    if (p >= end) {
+                        throw ImageException{"truncated QOI data"};
+                    }
+                    const int dg {(op & 0x3F) - 32};
+                    px[0] += dg - 8 + (*p >> 4);
+                    px[1] += dg;
+                    px[2] += dg - 8 + (*p & 0x0F);
+                    p++;
+                    break;
+                }
+                case 3: // QOI_OP_RUN
+                    run = (op & 0x3F) + 1;
+                    break;
+            }
+        }
+
+        std::memcpy(seen[(px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) % 64], px, 4);
+        for (const size_t last {std::min(n, i + run)}; i < last; i++) {
+            std::memcpy(out + i*4, px, 4);
+        }
+    }
+
+    premultiply(out, out, n);
+    return img;
+}
+
+}
@@ -0,0 +1,41 @@
+#include "image.h"
+
+namespace image {
+
+ImageCache& ImageCache::the() {
+    static ImageCache instance {};
+    return instance;
+}
+
+std::string ImageCache::make_key(const std::string& path, const uint32_t w, const uint32_t h) {
+    return std::to_string(w) + "x" + std::to_string(h) + ":" + path;
+}
+
+std::shared_ptr<const drm::MemBuffer> ImageCache::get(const std::string& path, const uint32_t w, const uint32_t h) {
+    const auto key {make_key(path, w, h)};
+    if (auto image {cache.find(key)}) {
+        return image;
+    }
+
+    std::shared_ptr<const drm::MemBuffer> image;
+    if (w == 0 && h == 0) {
+        image = load(path);
+    } else {
+        // Scaled copies are derived from the natural-size image, which is cached too
+        const auto original {get(path)};
+        const uint32_t src_w {original->get_width()}, src_h {original->get_height()};
+
+        // If only one dimension is given, the other keeps the image's aspect ratio
+        const uint32_t scaled_w {w ? w : std::max<uint32_t>(1, uint64_t{src_w} * h / src_h)};
+        const uint32_t scaled_h {h ? h : std::max<uint32_t>(1, uint64_t{src_h} * w / src_w)};
+        if (scaled_w == src_w && scaled_h == src_h) {
+            return original; // Already cached under its natural size; a second entry would count its pixels twice
+        }
+        image = scale(*original, scaled_w, scaled_h);
+    }
+
+    cache.insert(key, image);
+    return image;
+}
+
+}
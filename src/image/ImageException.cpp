@@ -0,0 +1,7 @@
+#include "image.h"
+
+namespace image {
+
+ImageException::ImageException(const std::string msg) noexcept : std::runtime_error(msg) {}
+
+}
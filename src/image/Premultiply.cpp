@@ -0,0 +1,40 @@
+#include "image.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace image {
+
+void premultiply(const uint8_t* src, uint8_t* dst, const size_t n) noexcept {
+    size_t i {0};
+#ifdef __SSE2__
+    // Each pixel is widened to four 16-bit lanes, multiplied by its broadcast alpha (or by 255 in the alpha lane, to
+    // keep it), divided by 255 with correct rounding and then swizzled from R, G, B, A to B, G, R, A
+    const __m128i zero {_mm_setzero_si128()};
+    const __m128i half {_mm_set1_epi16(128)};
+    const __m128i alpha_lanes {_mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0)};
+    const __m128i keep_alpha {_mm_set_epi16(0xFF, 0, 0, 0, 0xFF, 0, 0, 0)};
+    const auto premultiply_pair {[&](__m128i px) {
+        __m128i a {_mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3))};
+        a = _mm_or_si128(_mm_andnot_si128(alpha_lanes, a), keep_alpha);
+        px = _mm_add_epi16(_mm_mullo_epi16(px, a), half);
+        px = _mm_srli_epi16(_mm_add_epi16(px, _mm_srli_epi16(px, 8)), 8);
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+    }};
+    for (; i + 4 <= n; i += 4) {
+        const __m128i px {_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i*4))};
+        const __m128i lo {premultiply_pair(_mm_unpacklo_epi8(px, zero))};
+        const __m128i hi {premultiply_pair(_mm_unpackhi_epi8(px, zero))};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i*4), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < n; i++) {
+        const uint8_t r {src[i*4]}, g {src[i*4 + 1]}, b {src[i*4 + 2]}, a {src[i*4 + 3]};
+        dst[i*4]     = style::Colour::div255(b * a);
+        dst[i*4 + 1] = style::Colour::div255(g * a);
+        dst[i*4 + 2] = style::Colour::div255(r * a);
+        dst[i*4 + 3] = a;
+    }
+}
+
+}
@@ -0,0 +1,55 @@
+#include "image.h"
+#include <algorithm>
+#include <vector>
+
+namespace image {
+
+// Sample positions are pixel centres, in 24.8 fixed point
+static void make_taps(const uint32_t src_len, const uint32_t dst_len, std::vector<uint32_t>& index, std::vector<uint32_t>& weight) {
+    index.resize(dst_len);
+    weight.resize(dst_len);
+    for (uint32_t i {0}; i < dst_len; i++) {
+        const int64_t pos {std::max<int64_t>(0, ((2 * int64_t{i} + 1) * src_len * 256 / dst_len - 256) / 2)};
+        index[i] = std::min<uint32_t>(pos >> 8, src_len - 1);
+        weight[i] = index[i] + 1 < src_len ? pos & 0xFF : 0;
+    }
+}
+
+// Pixels are premultiplied, so channels can be interpolated independently without colour fringes at transparent edges
+std::unique_ptr<drm::MemBuffer> scale(const drm::Buffer& src, const uint32_t w, const uint32_t h) {
+    const uint32_t src_w {src.get_width()}, src_h {src.get_height()};
+    if (w == 0 || h == 0 || src_w == 0 || src_h == 0) {
+        throw ImageException{"cannot scale to or from an empty image"};
+    }
+
+    auto dst {std::make_unique<drm::MemBuffer>(w, h, 32)};
+
+    std::vector<uint32_t> xs, xw, ys, yw;
+    make_taps(src_w, w, xs, xw);
+    make_taps(src_h, h, ys, yw);
+
+    const auto src_pixels {reinterpret_cast<const uint32_t*>(src.get_buffer())};
+    const uint32_t src_pitch {src.get_stride() / 4};
+    auto dst_pixels {reinterpret_cast<uint32_t*>(dst->get_buffer())};
+
+    for (uint32_t j {0}; j < h; j++) {
+        const auto row0 {src_pixels + ys[j] * src_pitch};
+        const auto row1 {yw[j] ? row0 + src_pitch : row0};
+        const uint32_t fy {yw[j]};
+        for (uint32_t i {0}; i < w; i++) {
+            const uint32_t x0 {xs[i]}, x1 {xw[i] ? x0 + 1 : x0};
+            const uint32_t fx {xw[i]};
+            uint32_t v {0};
+            for (uint32_t shift {0}; shift < 32; shift += 8) {
+                const uint32_t top {((row0[x0] >> shift) & 0xFF) * (256 - fx) + ((row0[x1] >> shift) & 0xFF) * fx};
+                const uint32_t bottom {((row1[x0] >> shift) & 0xFF) * (256 - fx) + ((row1[x1] >> shift) & 0xFF) * fx};
+                v |= ((top * (256 - fy) + bottom * fy + 0x8000) >> 16) << shift;
+            }
+            dst_pixels[j * w + i] = v;
+        }
+    }
+
+    return dst;
+}
+
+}
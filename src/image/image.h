@@ -0,0 +1,56 @@
+#include "../cache/cache.h"
+#include "../drm/drm.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+namespace image {
+
+class ImageException : public std::runtime_error {
+public:
+    ImageException(const std::string msg) noexcept;
+};
+
+// Decoders produce premultiplied ARGB buffers, ready to be painted. The format is detected from the data's magic
+// bytes rather than the file extension
+std::unique_ptr<drm::MemBuffer> load(const std::string& path);
+std::unique_ptr<drm::MemBuffer> decode(const uint8_t* data, const size_t size);
+std::unique_ptr<drm::MemBuffer> decode_png(const uint8_t* data, const size_t size);
+std::unique_ptr<drm::MemBuffer> decode_qoi(const uint8_t* data, const size_t size);
+
+// Converts n straight-alpha RGBA pixels to premultiplied ARGB (B, G, R, A in memory). src and dst may be the same
+void premultiply(const uint8_t* src, uint8_t* dst, const size_t n) noexcept;
+
+// Bilinearly resamples a buffer to w x h
+// TODO: bilinear filtering aliases when shrinking by more than half; use a box filter for large reductions
+std::unique_ptr<drm::MemBuffer> scale(const drm::Buffer& src, const uint32_t w, const uint32_t h);
+
+// ImageCache holds decoded images keyed by path and size, so that assets used on many screens are only decoded once.
+// Memory is bounded: when the budget is exceeded, the least recently used images are dropped. Images are shared, so
+// an evicted image stays valid for as long as someone still holds it
+class ImageCache {
+public:
+    ImageCache(const size_t max_bytes = 64 << 20) noexcept : cache{max_bytes} {};
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+    static ImageCache& the();
+    // A width or height of 0 means the image's natural size
+    std::shared_ptr<const drm::MemBuffer> get(const std::string& path, const uint32_t w = 0, const uint32_t h = 0);
+    void set_max_bytes(const size_t bytes) noexcept { cache.set_max_bytes(bytes); };
+    size_t get_max_bytes() const noexcept { return cache.get_max_bytes(); };
+    size_t get_used_bytes() const noexcept { return cache.get_used_bytes(); };
+    void clear() noexcept { cache.clear(); };
+private:
+    static std::string make_key(const std::string& path, const uint32_t w, const uint32_t h);
+
+    cache::LRUByteCache<drm::MemBuffer> cache;
+};
+
+}
+
+#endif
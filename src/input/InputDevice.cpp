@@ -0,0 +1,57 @@
+#include "input.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace input {
+
+InputDevice::InputDevice(const std::string& path) :
+        path{path}, fd{open_device()}, name{fetch_name()}, absolute{fetch_absolute()} {
+    try {
+        resync();
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+}
+
+InputDevice::~InputDevice() {
+    close(fd);
+}
+
+int InputDevice::open_device() const {
+    const auto fd {open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC)};
+    if (fd < 0) {
+        throw InputException{"failed to open input device " + path, errno};
+    }
+    return fd;
+}
+
+std::string InputDevice::fetch_name() const {
+    char buf[256] {};
+    if (ioctl(fd, EVIOCGNAME(sizeof(buf) - 1), buf) < 0) {
+        return path;
+    }
+    return buf;
+}
+
+bool InputDevice::fetch_absolute() const {
+    unsigned long bits {0};
+    if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(bits)), &bits) < 0) {
+        return false;
+    }
+    return (bits & (1ul << ABS_X)) && (bits & (1ul << ABS_Y));
+}
+
+// Rereads the axis ranges and current positions, e.g. after events were dropped
+void InputDevice::resync() {
+    if (!absolute) {
+        return;
+    }
+    if (ioctl(fd, EVIOCGABS(ABS_X), &abs_x) < 0 || ioctl(fd, EVIOCGABS(ABS_Y), &abs_y) < 0) {
+        throw InputException{"failed to read axes of " + path, errno};
+    }
+}
+
+}
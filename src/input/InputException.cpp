@@ -0,0 +1,11 @@
+#include "input.h"
+#include <cstring>
+
+namespace input {
+
+InputException::InputException(const std::string msg) noexcept : std::runtime_error(msg) {}
+
+InputException::InputException(const std::string msg, const int errnum) noexcept :
+        std::runtime_error(msg + ": " + std::strerror(errnum)) {}
+
+}
@@ -0,0 +1,257 @@
+#include "input.h"
+#include "../gui/gui.h"
+#include "../logging/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace input {
+
+InputManager::InputManager() : timer_fd{create_timer()} {
+    try {
+        timer_watch_id = gui::DisplayManager::the().add_fd(timer_fd, EPOLLIN, gui::EventPriority::INPUT,
+            [this](const uint32_t) { update(); });
+    } catch (...) {
+        close(timer_fd);
+        throw;
+    }
+}
+
+InputManager::~InputManager() {
+    auto& dm {gui::DisplayManager::the()};
+    for (const auto& [path, device]: devices) {
+        dm.remove_fd(device.watch_id);
+    }
+    dm.remove_fd(timer_watch_id);
+    close(timer_fd);
+}
+
+InputManager& InputManager::the() {
+    static InputManager instance;
+    return instance;
+}
+
+int InputManager::create_timer() const {
+    const auto fd {timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)};
+    if (fd < 0) {
+        throw InputException{"failed to create cursor timer", errno};
+    }
+    return fd;
+}
+
+void InputManager::add_device(const std::string& path) {
+    if (devices.count(path)) {
+        return;
+    }
+
+    auto device {std::make_unique<InputDevice>(path)};
+    auto& ref {*device};
+    const auto watch_id {gui::DisplayManager::the().add_fd(device->get_fd(), EPOLLIN, gui::EventPriority::INPUT,
+        [this, &ref](const uint32_t) { read_device(ref); })};
+    devices.emplace(path, Device{std::move(device), watch_id});
+}
+
+// Adds every evdev node. Devices that can't be opened (usually for lack of permission) are skipped
+// TODO: watch /dev/input with inotify to pick up devices plugged in later
+void InputManager::add_all_devices() {
+    const auto dir {opendir("/dev/input")};
+    if (!dir) {
+        throw InputException{"failed to open /dev/input", errno};
+    }
+
+    while (const auto entry {readdir(dir)}) {
+        const std::string name {entry->d_name};
+        if (name.rfind("event", 0) != 0) {
+            continue;
+        }
+        try {
+            add_device("/dev/input/" + name);
+        } catch (const std::exception& e) {
+            LOG_WARNING("skipping input device: " << e.what());
+        }
+    }
+    closedir(dir);
+}
+
+void InputManager::remove_device(const std::string& path) noexcept {
+    const auto it {devices.find(path)};
+    if (it == devices.end()) {
+        return;
+    }
+    gui::DisplayManager::the().remove_fd(it->second.watch_id);
+    devices.erase(it);
+}
+
+void InputManager::set_bounds(const uint32_t width, const uint32_t height) noexcept {
+    this->width = width;
+    this->height = height;
+    move_to(x, y);
+}
+
+// The cursor's top-left corner is placed hot_x, hot_y up and left of the pointer position
+void InputManager::set_cursor(drm::CursorBitmap* cursor, const int32_t hot_x, const int32_t hot_y) {
+    this->cursor = cursor;
+    this->hot_x = hot_x;
+    this->hot_y = hot_y;
+    if (cursor) {
+        cursor_pending = true;
+        schedule_update();
+    }
+}
+
+// Drains the device in batches, so that a burst of reports costs one wakeup
+void InputManager::read_device(InputDevice& device) {
+    input_event buf[64];
+    ssize_t n;
+    while ((n = read(device.get_fd(), buf, sizeof(buf))) > 0) {
+        for (ssize_t i {0}; i < n / static_cast<ssize_t>(sizeof(input_event)); i++) {
+            handle_event(device, buf[i]);
+        }
+    }
+
+    if (n < 0 && errno == ENODEV) {
+        const auto path {device.get_path()}; // device is destroyed by remove_device
+        remove_device(path);
+    }
+}
+
+void InputManager::handle_event(InputDevice& device, const input_event& event) {
+    if (device.is_dropping()) {
+        // The kernel lost events: skip to the end of the incomplete report and reread the device's state
+        if (event.type == EV_SYN && event.code == SYN_REPORT) {
+            device.set_dropping(false);
+            try {
+                device.resync();
+                if (device.is_absolute()) {
+                    move_to(scale_abs(device.get_abs_x().value, device.get_abs_x(), width),
+                        scale_abs(device.get_abs_y().value, device.get_abs_y(), height));
+                }
+            } catch (const InputException& e) {
+                LOG_ERROR(e.what());
+            }
+        }
+        return;
+    }
+
+    switch (event.type) {
+        case EV_SYN:
+            if (event.code == SYN_DROPPED) {
+                device.set_dropping(true);
+            } else if (event.code == SYN_REPORT) {
+                if ((scroll_dx || scroll_dy) && scroll_handler) {
+                    scroll_handler(ScrollEvent{scroll_dx, scroll_dy, x, y});
+                }
+                scroll_dx = scroll_dy = 0;
+                if (motion_pending || cursor_pending) {
+                    schedule_update();
+                }
+            }
+            break;
+        case EV_REL:
+            if (event.code == REL_X) {
+                move_to(x + event.value, y);
+            } else if (event.code == REL_Y) {
+                move_to(x, y + event.value);
+            } else if (event.code == REL_WHEEL) {
+                scroll_dy += event.value;
+            } else if (event.code == REL_HWHEEL) {
+                scroll_dx += event.value;
+            }
+            break;
+        case EV_ABS:
+            if (event.code == ABS_X) {
+                move_to(scale_abs(event.value, device.get_abs_x(), width), y);
+            } else if (event.code == ABS_Y) {
+                move_to(x, scale_abs(event.value, device.get_abs_y(), height));
+            }
+            break;
+        case EV_KEY:
+            // Motion is already folded into x and y, so a click lands where the pointer really is even though the
+            // cursor may not have caught up yet
+            if ((event.code >= BTN_MOUSE && event.code <= BTN_TASK) || event.code == BTN_TOUCH) {
+                if (event.value != 2 && button_handler) {
+                    button_handler(ButtonEvent{event.code, event.value != 0, x, y});
+                }
+            } else if (key_handler) {
+                key_handler(KeyEvent{event.code, event.value});
+            }
+            break;
+    }
+}
+
+void InputManager::move_to(int32_t new_x, int32_t new_y) noexcept {
+    if (width > 0) {
+        new_x = std::clamp<int32_t>(new_x, 0, width - 1);
+    }
+    if (height > 0) {
+        new_y = std::clamp<int32_t>(new_y, 0, height - 1);
+    }
+    if (new_x != x || new_y != y) {
+        x = new_x;
+        y = new_y;
+        motion_pending = cursor_pending = true;
+    }
+}
+
+// Maps an absolute axis onto the screen. Without bounds, the device's own coordinates are used
+int32_t InputManager::scale_abs(const int32_t value, const input_absinfo& info, const uint32_t extent) const noexcept {
+    const int64_t range {int64_t{info.maximum} - info.minimum};
+    if (extent == 0 || range <= 0) {
+        return value;
+    }
+    return (int64_t{value} - info.minimum) * (extent - 1) / range;
+}
+
+// Arms the timer for the commit deadline of the next vblank not already aimed at. If the deadline has passed, the
+// update happens at once and the commit simply lands a frame later
+void InputManager::schedule_update() {
+    if (update_scheduled) {
+        return;
+    }
+
+    auto& dm {gui::DisplayManager::the()};
+    const auto now {std::chrono::steady_clock::now()};
+    target = dm.predict_vblank(std::max(now, last_target));
+    const auto deadline {std::max(now, target - commit_margin)};
+
+    const auto ns {std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count()};
+    itimerspec spec {};
+    spec.it_value = timespec{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1; // A zero it_value would disarm the timer
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        throw InputException{"failed to arm cursor timer", errno};
+    }
+    update_scheduled = true;
+}
+
+// Runs at the commit deadline: delivers the latest position, however many reports it took to get there
+void InputManager::update() {
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+        return;
+    }
+    update_scheduled = false;
+    last_target = target;
+
+    if (motion_pending) {
+        motion_pending = false;
+        if (motion_handler) {
+            motion_handler(x, y);
+        }
+    }
+
+    if (cursor_pending) {
+        if (!cursor || cursor->move(x - hot_x, y - hot_y)) {
+            cursor_pending = false;
+        } else {
+            schedule_update(); // The CRTC is busy, or the move is riding on the next frame: check at the next vblank
+        }
+    }
+}
+
+}
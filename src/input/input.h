@@ -0,0 +1,131 @@
+#include "../drm/drm.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <linux/input.h>
+
+#ifndef INPUT_H
+#define INPUT_H
+
+namespace input {
+
+class InputException : public std::runtime_error {
+public:
+    InputException(const std::string msg) noexcept;
+    InputException(const std::string msg, const int errnum) noexcept;
+};
+
+struct ButtonEvent {
+    uint16_t button; // BTN_LEFT etc.
+    bool pressed;
+    int32_t x, y;
+};
+
+struct KeyEvent {
+    uint16_t key; // KEY_A etc.
+    int32_t value; // 0 for release, 1 for press, 2 for autorepeat
+};
+
+struct ScrollEvent {
+    int32_t dx, dy; // In wheel detents
+    int32_t x, y;
+};
+
+// An evdev device node. Only the axes the pointer needs are tracked
+class InputDevice {
+public:
+    InputDevice(const std::string& path);
+    InputDevice(const InputDevice&) = delete;
+    InputDevice& operator=(const InputDevice&) = delete;
+    ~InputDevice();
+    int get_fd() const noexcept { return fd; };
+    const std::string& get_path() const noexcept { return path; };
+    const std::string& get_name() const noexcept { return name; };
+    bool is_absolute() const noexcept { return absolute; };
+    const input_absinfo& get_abs_x() const noexcept { return abs_x; };
+    const input_absinfo& get_abs_y() const noexcept { return abs_y; };
+    void resync();
+    bool is_dropping() const noexcept { return dropping; };
+    void set_dropping(const bool dropping) noexcept { this->dropping = dropping; };
+private:
+    int open_device() const;
+    std::string fetch_name() const;
+    bool fetch_absolute() const;
+
+    const std::string path;
+    const int fd;
+    const std::string name;
+    const bool absolute; // Tablets and touchscreens report positions rather than movements
+    input_absinfo abs_x {}, abs_y {};
+    bool dropping {false}; // The kernel's buffer overflowed; events are discarded until the next SYN_REPORT
+};
+
+// InputManager reads every device and tracks the pointer. Buttons, keys and scrolling are delivered as soon as they
+// are read, but motion is only folded into the pointer position: the cursor is moved, and the motion handler called,
+// at most once per vblank, just before the commit deadline, using the latest position. A 1000Hz mouse therefore costs
+// one cursor commit per frame rather than one per report, and the cursor is as fresh as it can be when scanned out
+class InputManager {
+public:
+    using MotionHandler = std::function<void(const int32_t x, const int32_t y)>;
+    using ButtonHandler = std::function<void(const ButtonEvent& event)>;
+    using KeyHandler = std::function<void(const KeyEvent& event)>;
+    using ScrollHandler = std::function<void(const ScrollEvent& event)>;
+
+    InputManager();
+    InputManager(const InputManager&) = delete;
+    InputManager& operator=(const InputManager&) = delete;
+    ~InputManager();
+    static InputManager& the();
+    void add_device(const std::string& path);
+    void add_all_devices();
+    void remove_device(const std::string& path) noexcept;
+    void set_bounds(const uint32_t width, const uint32_t height) noexcept;
+    void set_cursor(drm::CursorBitmap* cursor, const int32_t hot_x = 0, const int32_t hot_y = 0);
+    void set_commit_margin(const std::chrono::nanoseconds margin) noexcept { commit_margin = margin; };
+    void set_motion_handler(MotionHandler handler) noexcept { motion_handler = std::move(handler); };
+    void set_button_handler(ButtonHandler handler) noexcept { button_handler = std::move(handler); };
+    void set_key_handler(KeyHandler handler) noexcept { key_handler = std::move(handler); };
+    void set_scroll_handler(ScrollHandler handler) noexcept { scroll_handler = std::move(handler); };
+    int32_t get_x() const noexcept { return x; };
+    int32_t get_y() const noexcept { return y; };
+private:
+    struct Device {
+        std::unique_ptr<InputDevice> device;
+        uint64_t watch_id;
+    };
+
+    int create_timer() const;
+    void read_device(InputDevice& device);
+    void handle_event(InputDevice& device, const input_event& event);
+    void move_to(const int32_t new_x, const int32_t new_y) noexcept;
+    int32_t scale_abs(const int32_t value, const input_absinfo& info, const uint32_t extent) const noexcept;
+    void schedule_update();
+    void update();
+
+    const int timer_fd; // Fires at the cursor commit deadline
+    uint64_t timer_watch_id;
+    std::map<std::string, Device> devices {};
+    uint32_t width {0}, height {0}; // The pointer is confined to these bounds, if they are set
+    int32_t x {0}, y {0};
+    int32_t scroll_dx {0}, scroll_dy {0};
+    bool motion_pending {false}; // The motion handler hasn't seen the latest position
+    bool cursor_pending {false}; // The cursor hasn't been moved to the latest position
+    bool update_scheduled {false};
+    std::chrono::steady_clock::time_point target {}; // The vblank the scheduled update is aimed at
+    std::chrono::steady_clock::time_point last_target {};
+    std::chrono::nanoseconds commit_margin {std::chrono::milliseconds{2}};
+    drm::CursorBitmap* cursor {nullptr};
+    int32_t hot_x {0}, hot_y {0};
+    MotionHandler motion_handler {};
+    ButtonHandler button_handler {};
+    KeyHandler key_handler {};
+    ScrollHandler scroll_handler {};
+};
+
+}
+
+#endif
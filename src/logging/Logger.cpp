@@ -0,0 +1,239 @@
+#include "logging.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace logging {
+
+const char* get_level_name(const Level level) noexcept {
+    switch (level) {
+        case Level::DEBUG: return "debug";
+        case Level::INFO: return "info";
+        case Level::WARNING: return "warning";
+        case Level::ERROR: return "error";
+    }
+    return "unknown";
+}
+
+static uint32_t get_tid() noexcept {
+    thread_local const uint32_t tid {static_cast<uint32_t>(syscall(SYS_gettid))};
+    return tid;
+}
+
+Message::Message(const Level level, const char* file, const uint32_t line) noexcept :
+        buf{record.message, Record::max_message}, out{&buf} {
+    record.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    record.tid = get_tid();
+    record.level = level;
+    record.file = file;
+    record.line = line;
+}
+
+Message::~Message() {
+    record.length = buf.get_length();
+    Logger::the().submit(record);
+}
+
+Logger::Logger(const size_t capacity) :
+        mask{round_capacity(capacity) - 1}, slots{std::make_unique<Slot[]>(mask + 1)} {
+    for (size_t i {0}; i <= mask; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    drainer = std::thread{&Logger::run, this};
+}
+
+// Records still queued are written out before returning
+Logger::~Logger() {
+    {
+        const std::lock_guard<std::mutex> lock {wake_mutex};
+        stopping = true;
+    }
+    wake.notify_one();
+    drainer.join();
+}
+
+// Deliberately never destroyed, so that destructors of other statics can still log while the program exits. Records
+// still queued at exit are written out by a handler registered once the logger exists, so it runs after the
+// destructors of any statics made later
+Logger& Logger::the() {
+    static Logger* const instance {[]() {
+        const auto logger {new Logger{}};
+        std::atexit([]() { the().flush(); });
+        return logger;
+    }()};
+    return *instance;
+}
+
+size_t Logger::round_capacity(const size_t capacity) noexcept {
+    size_t rounded {2};
+    while (rounded < capacity) {
+        rounded *= 2;
+    }
+    return rounded;
+}
+
+// The sink is called on the drain thread, or on whichever thread calls flush()
+void Logger::set_sink(Sink sink) {
+    const std::lock_guard<std::mutex> lock {sink_mutex};
+    this->sink = std::move(sink);
+}
+
+// Callable from any thread. Claims a slot with a compare-and-swap on the tail, so writers never wait on each other or
+// on the drain thread
+void Logger::submit(const Record& record) noexcept {
+    auto pos {tail.load(std::memory_order_relaxed)};
+    Slot* slot;
+    while (true) {
+        slot = &slots[pos & mask];
+        const auto sequence {slot->sequence.load(std::memory_order_acquire)};
+        const auto diff {static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos)};
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            total_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::memcpy(&slot->record, &record, offsetof(Record, message) + record.length);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    // Errors are written promptly, and a filling ring is drained before it overflows. Anything else waits for the drain
+    // thread's next pass, rather than waking it for every record
+    if (record.level == Level::ERROR || pos - head.load(std::memory_order_relaxed) == (mask + 1) / 2) {
+        wake.notify_one();
+    }
+}
+
+bool Logger::pop(Record& record) noexcept {
+    auto pos {head.load(std::memory_order_relaxed)};
+    Slot* slot;
+    while (true) {
+        slot = &slots[pos & mask];
+        const auto sequence {slot->sequence.load(std::memory_order_acquire)};
+        const auto diff {static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1)};
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::memcpy(&record, &slot->record, offsetof(Record, message) + slot->record.length);
+    slot->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+}
+
+// Writes out every queued record. Without a sink, they are batched into one write to stderr
+void Logger::drain() noexcept {
+    const std::lock_guard<std::mutex> lock {sink_mutex};
+    try {
+        std::string batch;
+        const auto emit {[this, &batch](const Record& record) {
+            if (sink) {
+                sink(record);
+            } else {
+                batch += format(record);
+            }
+        }};
+
+        Record record;
+        while (pop(record)) {
+            emit(record);
+        }
+
+        const auto lost {dropped.exchange(0, std::memory_order_relaxed)};
+        if (lost) {
+            Record note {};
+            note.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            note.tid = get_tid();
+            note.level = Level::WARNING;
+            note.file = __FILE__;
+            note.line = __LINE__;
+            note.length = std::snprintf(note.message, Record::max_message, "%llu log records dropped",
+                static_cast<unsigned long long>(lost));
+            emit(note);
+        }
+
+        const char* p {batch.data()};
+        size_t left {batch.size()};
+        while (left > 0) {
+            const auto n {write(STDERR_FILENO, p, left)};
+            if (n <= 0) {
+                break;
+            }
+            p += n;
+            left -= n;
+        }
+    } catch (...) {
+        // There is nowhere left to report a failure to log
+    }
+}
+
+void Logger::flush() noexcept {
+    drain();
+}
+
+void Logger::run() {
+    std::unique_lock<std::mutex> lock {wake_mutex};
+    while (!stopping) {
+        wake.wait_for(lock, std::chrono::milliseconds{100});
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+    lock.unlock();
+    drain();
+}
+
+// logfmt: time=2026-01-01T00:00:00.000000Z level=error thread=1234 source=DRMCard.cpp:104 msg="..."
+std::string Logger::format(const Record& record) {
+    const auto seconds {static_cast<time_t>(record.time_ns / 1000000000)};
+    tm utc {};
+    gmtime_r(&seconds, &utc);
+    char time[32];
+    std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+
+    const char* file {record.file ? record.file : ""};
+    const auto slash {std::strrchr(file, '/')};
+    if (slash) {
+        file = slash + 1;
+    }
+
+    char prefix[160];
+    std::snprintf(prefix, sizeof(prefix), "time=%s.%06uZ level=%s thread=%u source=%s:%u msg=\"", time,
+        static_cast<unsigned>(record.time_ns / 1000 % 1000000), get_level_name(record.level), record.tid, file,
+        record.line);
+
+    std::string line {prefix};
+    for (uint32_t i {0}; i < record.length; i++) {
+        const auto c {record.message[i]};
+        if (c == '"' || c == '\\') {
+            line += '\\';
+            line += c;
+        } else if (c == '\n') {
+            line += "\\n";
+        } else {
+            line += c;
+        }
+    }
+    line += "\"\n";
+    return line;
+}
+
+}
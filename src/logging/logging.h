@@ -0,0 +1,141 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+#ifndef LOGGING_H
+#define LOGGING_H
+
+// Records below LOG_LEVEL are compiled out, so their arguments aren't even evaluated: 0 keeps debug records, 1 info,
+// 2 warnings, 3 errors only. Release (NDEBUG) builds default to dropping debug records. Usage:
+//     LOG_ERROR("failed to probe connector #" << id << ": " << e.what());
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL 1
+#else
+#define LOG_LEVEL 0
+#endif
+#endif
+
+#define LOG_AT(level, expr) do { \
+        if (logging::Logger::the().is_enabled(level)) { \
+            logging::Message{level, __FILE__, __LINE__}.stream() << expr; \
+        } \
+    } while (false)
+
+#if LOG_LEVEL <= 0
+#define LOG_DEBUG(expr) LOG_AT(logging::Level::DEBUG, expr)
+#else
+#define LOG_DEBUG(expr) static_cast<void>(0)
+#endif
+#if LOG_LEVEL <= 1
+#define LOG_INFO(expr) LOG_AT(logging::Level::INFO, expr)
+#else
+#define LOG_INFO(expr) static_cast<void>(0)
+#endif
+#if LOG_LEVEL <= 2
+#define LOG_WARNING(expr) LOG_AT(logging::Level::WARNING, expr)
+#else
+#define LOG_WARNING(expr) static_cast<void>(0)
+#endif
+#define LOG_ERROR(expr) LOG_AT(logging::Level::ERROR, expr)
+
+namespace logging {
+
+enum class Level : uint8_t {DEBUG, INFO, WARNING, ERROR};
+
+const char* get_level_name(const Level level) noexcept;
+
+// A record is fixed-size, so that it can be queued without allocating. Longer messages are truncated
+struct Record {
+    static constexpr size_t max_message {240};
+
+    uint64_t time_ns; // system_clock, since the epoch
+    uint32_t tid;
+    Level level;
+    const char* file; // From __FILE__, so it lives for the whole program
+    uint32_t line;
+    uint32_t length;
+    char message[max_message];
+};
+
+// Formats a message straight into its record, rather than building a string on the heap and copying it in
+class MessageBuffer : public std::streambuf {
+public:
+    MessageBuffer(char* buf, const size_t size) noexcept { setp(buf, buf + size); };
+    size_t get_length() const noexcept { return pptr() - pbase(); };
+};
+
+// Message builds one record, queueing it when it is destroyed at the end of the LOG_ statement
+class Message {
+public:
+    Message(const Level level, const char* file, const uint32_t line) noexcept;
+    Message(const Message&) = delete;
+    Message& operator=(const Message&) = delete;
+    ~Message();
+    std::ostream& stream() noexcept { return out; };
+private:
+    Record record;
+    MessageBuffer buf;
+    std::ostream out;
+};
+
+// Logger queues records from any thread on a bounded, lock-free ring, and a background thread drains them to the sink,
+// so that logging never blocks the caller on I/O. When the ring is full, records are dropped and counted rather than
+// stalling the caller; the count is reported with the next records written. By default, records are written to stderr
+// as logfmt lines
+class Logger {
+public:
+    using Sink = std::function<void(const Record& record)>;
+
+    Logger(const size_t capacity = 1024);
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+    ~Logger();
+    static Logger& the();
+    bool is_enabled(const Level level) const noexcept { return level >= min_level.load(std::memory_order_relaxed); };
+    void set_level(const Level level) noexcept { min_level.store(level, std::memory_order_relaxed); };
+    void set_sink(Sink sink);
+    void submit(const Record& record) noexcept;
+    void flush() noexcept;
+    uint64_t get_dropped() const noexcept { return total_dropped.load(std::memory_order_relaxed); };
+    static std::string format(const Record& record);
+private:
+    // Each slot's sequence number says whose turn it is: a writer may fill it when it equals the writer's position,
+    // and the reader may take it when it is one past
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    static size_t round_capacity(const size_t capacity) noexcept;
+    bool pop(Record& record) noexcept;
+    void drain() noexcept;
+    void run();
+
+    const size_t mask;
+    const std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> tail {0}; // Next position to write
+    alignas(64) std::atomic<size_t> head {0}; // Next position to read
+    std::atomic<Level> min_level {Level::INFO};
+    std::atomic<uint64_t> dropped {0}; // Since last reported
+    std::atomic<uint64_t> total_dropped {0};
+
+    std::mutex sink_mutex {}; // Held while draining, so records are written in order
+    Sink sink {};
+    std::mutex wake_mutex {};
+    std::condition_variable wake {};
+    bool stopping {false};
+    std::thread drainer;
+};
+
+}
+
+#endif
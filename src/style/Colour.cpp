@@ -1,5 +1,51 @@
 #include "style.h"
+#include <cmath>
+#include <memory>
 
 namespace style {
 
+float srgb_to_linear(const float c) noexcept {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linear_to_srgb(const float l) noexcept {
+    return l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+}
+
+static std::unique_ptr<LinearLUT> make_linear_lut() {
+    auto lut {std::make_unique<LinearLUT>()};
+
+    double linear[256];
+    for (uint32_t i {0}; i < 256; i++) {
+        linear[i] = srgb_to_linear(i / 255.0f);
+    }
+
+    // Premultiplied channel values are unpremultiplied, linearised, then premultiplied again in linear space
+    for (uint32_t a {0}; a < 256; a++) {
+        for (uint32_t c {0}; c < 256; c++) {
+            const uint32_t unpremultiplied {a == 0 ? 0 : std::min(0xFFu, (c*0xFF + a/2) / a)};
+            lut->to_linear[a][c] = static_cast<uint16_t>(std::lround(linear[unpremultiplied] * a / 255.0 * 0xFFFF));
+        }
+    }
+
+    // Sample each bucket of 16 linear values at its centre
+    for (uint32_t i {0}; i < 4096; i++) {
+        const float l {std::min(1.0f, (i*16 + 8) / 65535.0f)};
+        lut->to_srgb[i] = static_cast<uint8_t>(std::lround(linear_to_srgb(l) * 0xFF));
+    }
+
+    // Exactly 4096 for opaque pixels, which are then left as they are
+    lut->unpremultiply[0] = 0;
+    for (uint32_t a {1}; a < 256; a++) {
+        lut->unpremultiply[a] = (4096 * 255 + a/2) / a;
+    }
+
+    return lut;
+}
+
+const LinearLUT& LinearLUT::get() noexcept {
+    static const auto lut {make_linear_lut()};
+    return *lut;
+}
+
 }
@@ -6,6 +6,33 @@
 
 namespace style {
 
+enum class BlendQuality {
+    FAST,   // Approximates division by 255 with >>8, which slightly darkens on every blend
+    EXACT,  // Correctly rounded division by 255
+    LINEAR  // Exact, and blended in linear light rather than gamma-encoded sRGB
+};
+
+// How a source is combined with a destination. The Porter-Duff operators (CLEAR to XOR) treat alpha as coverage, and
+// ADD sums and clamps. The separable blend modes (MULTIPLY onwards) mix each colour channel with the one beneath it, as
+// in the W3C compositing spec, and composite the result like SRC_OVER
+enum class BlendOperator {
+    CLEAR, SRC, DST, SRC_OVER, DST_OVER, SRC_IN, DST_IN, SRC_OUT, DST_OUT, SRC_ATOP, DST_ATOP, XOR, ADD,
+    MULTIPLY, SCREEN, OVERLAY, HARD_LIGHT, DARKEN, LIGHTEN, DIFFERENCE, EXCLUSION
+};
+
+// The sRGB transfer function, for values from 0 to 1
+float srgb_to_linear(const float c) noexcept;
+float linear_to_srgb(const float l) noexcept;
+
+// LinearLUT holds the lookup tables for converting between premultiplied, gamma-encoded sRGB and premultiplied
+// 16-bit linear light
+struct LinearLUT {
+    uint16_t to_linear[256][256]; // Indexed by alpha, then premultiplied channel
+    uint8_t to_srgb[4096]; // Indexed by the top 12 bits of an unpremultiplied 16-bit linear value
+    uint32_t unpremultiply[256]; // 4096 * 255 / alpha: scales the top 12 bits of a premultiplied value to an index
+
+    static const LinearLUT& get() noexcept;
+};
 
 // Colour stores RGB+A colour information, with a pre-multiplied alpha value
 // TODO: move some of this to Colour.cpp
@@ -39,6 +66,11 @@ struct Colour {
     inline Colour lighten(const uint8_t shift) const noexcept;
 
     static inline uint32_t src_over(const uint32_t src_v, const uint32_t dst_v) noexcept;
+    static inline uint32_t src_over_exact(const uint32_t src_v, const uint32_t dst_v) noexcept;
+    static inline uint32_t src_over_linear(const uint32_t src_v, const uint32_t dst_v, const LinearLUT& lut) noexcept;
+
+    // Correctly rounded v/255 for v <= 255*255
+    static constexpr uint32_t div255(const uint32_t v) noexcept { return (v + 128 + ((v + 128) >> 8)) >> 8; };
 
     const uint8_t r, g, b, a;
 };
@@ -78,6 +110,45 @@ uint32_t Colour::src_over(const uint32_t src_v, const uint32_t dst_v) noexcept {
     return (a << 24) | (r << 16) | (g << 8) | b;
 }
 
+uint32_t Colour::src_over_exact(const uint32_t src_v, const uint32_t dst_v) noexcept {
+    const uint32_t p {0xFF - (src_v >> 24)};
+
+    uint32_t v {0};
+    for (uint32_t shift {0}; shift < 32; shift += 8) {
+        const uint32_t src_c {(src_v >> shift) & 0xFF};
+        const uint32_t dst_c {(dst_v >> shift) & 0xFF};
+        v |= (src_c + div255(dst_c*p)) << shift;
+    }
+    return v;
+}
+
+// Colours are premultiplied in sRGB space, so each channel is effectively unpremultiplied before linearising and
+// premultiplied again afterwards. All the arithmetic is integer: dst * p / 255 is taken as (dst * p * 257) >> 16, which
+// SIMD code can do with one 16-bit high multiply
+uint32_t Colour::src_over_linear(const uint32_t src_v, const uint32_t dst_v, const LinearLUT& lut) noexcept {
+    const uint32_t src_a {src_v >> 24};
+    const uint32_t dst_a {dst_v >> 24};
+    const uint32_t p {0xFF - src_a};
+    const uint32_t a {src_a + div255(dst_a*p)};
+    if (a == 0) {
+        return 0;
+    }
+
+    const auto& src_lut {lut.to_linear[src_a]};
+    const auto& dst_lut {lut.to_linear[dst_a]};
+    const uint32_t dst_scale {p * 257};
+    const uint32_t unpremultiply {lut.unpremultiply[a]};
+
+    uint32_t v {a << 24};
+    for (uint32_t shift {0}; shift < 24; shift += 8) {
+        const uint32_t dst_l {(dst_lut[(dst_v >> shift) & 0xFF] * dst_scale) >> 16};
+        const uint32_t l {std::min(0xFFFFu, src_lut[(src_v >> shift) & 0xFF] + dst_l)};
+        const uint32_t index {std::min(0xFFFu, ((l >> 4) * unpremultiply) >> 12)};
+        v |= div255(lut.to_srgb[index]*a) << shift;
+    }
+    return v;
+}
+
 }
 
 #endif
@@ -0,0 +1,70 @@
+#include "text.h"
+#include <atomic>
+
+namespace text {
+
+static std::atomic<uint32_t> next_font_id {1};
+
+Font::Font(const std::string& path, const uint32_t face_index) : id{next_font_id++}, face{load_face(path, face_index)} {}
+
+Font::~Font() {
+    FT_Done_Face(face);
+}
+
+// TODO: free the library at exit?
+FT_Library Font::get_library() {
+    static FT_Library library {nullptr};
+    if (!library) {
+        const auto err {FT_Init_FreeType(&library)};
+        if (err) {
+            library = nullptr;
+            throw TextException{"failed to initialise FreeType", err};
+        }
+    }
+    return library;
+}
+
+FT_Face Font::load_face(const std::string& path, const uint32_t face_index) const {
+    FT_Face face;
+    const auto err {FT_New_Face(get_library(), path.c_str(), face_index, &face)};
+    if (err) {
+        throw TextException{"failed to load font " + path, err};
+    }
+    return face;
+}
+
+// FreeType scales metrics and kerning to the face's current size, which is shared by everything using the font. Setting
+// it again is skipped, as FreeType recomputes the size's metrics every time
+bool Font::set_size(const uint32_t size) const noexcept {
+    if (size == current_size) {
+        return true;
+    }
+    if (FT_Set_Pixel_Sizes(face, 0, size)) {
+        current_size = 0;
+        return false;
+    }
+    current_size = size;
+    return true;
+}
+
+// Kerning adjustment in pixels between two glyphs, at the size last set
+int32_t Font::get_kerning(const uint32_t left, const uint32_t right) const noexcept {
+    if (!FT_HAS_KERNING(face) || !left || !right) {
+        return 0;
+    }
+
+    FT_Vector delta;
+    if (FT_Get_Kerning(face, left, right, FT_KERNING_DEFAULT, &delta)) {
+        return 0;
+    }
+    return delta.x >> 6;
+}
+
+uint32_t Font::get_line_height(const uint32_t size) const noexcept {
+    if (!set_size(size)) {
+        return size;
+    }
+    return face->size->metrics.height >> 6;
+}
+
+}
@@ -0,0 +1,140 @@
+#include "text.h"
+#include <algorithm>
+#include <cstring>
+
+namespace text {
+
+GlyphAtlas::GlyphAtlas(const size_t max_bytes) : max_pages{std::max<size_t>(1, max_bytes / (page_size * page_size))} {}
+
+GlyphAtlas& GlyphAtlas::the() {
+    static GlyphAtlas instance {};
+    return instance;
+}
+
+size_t GlyphAtlas::KeyHash::operator()(const Key& key) const noexcept {
+    const auto [font_id, size, glyph_index] {key};
+    return (static_cast<size_t>(font_id) << 48) ^ (static_cast<size_t>(size) << 32) ^ glyph_index;
+}
+
+// Returns nullptr if the glyph can't be rasterised, e.g. if it is bigger than a page
+const Glyph* GlyphAtlas::get_glyph(const Font& font, const uint32_t size, const uint32_t glyph_index) {
+    const auto it {glyphs.find(Key{font.get_id(), size, glyph_index})};
+    if (it == glyphs.end()) {
+        return rasterise(font, size, glyph_index);
+    }
+
+    if (!it->second.area.is_empty()) {
+        pages[it->second.page].last_used = ++clock;
+    }
+    return &it->second;
+}
+
+const Glyph* GlyphAtlas::rasterise(const Font& font, const uint32_t size, const uint32_t glyph_index) {
+    const auto face {font.get_face()};
+    if (!font.set_size(size) || FT_Load_Glyph(face, glyph_index, FT_LOAD_RENDER)) {
+        return nullptr;
+    }
+
+    const auto slot {face->glyph};
+    const auto& bitmap {slot->bitmap};
+    if (bitmap.pixel_mode != FT_PIXEL_MODE_GRAY && bitmap.width > 0) {
+        return nullptr;
+    }
+
+    const Key key {font.get_id(), size, glyph_index};
+
+    // Blank glyphs such as spaces only need their metrics. They are cheap to make again, so when there are too many
+    // they are all dropped rather than tracking which were used least recently
+    if (bitmap.width == 0 || bitmap.rows == 0) {
+        if (blank_keys.size() >= max_blank_glyphs) {
+            for (const auto& blank: blank_keys) {
+                glyphs.erase(blank);
+            }
+            blank_keys.clear();
+        }
+        blank_keys.push_back(key);
+        const Glyph glyph {0, drm::Rect{}, slot->bitmap_left, slot->bitmap_top, static_cast<int32_t>(slot->advance.x >> 6)};
+        return &glyphs.insert_or_assign(key, glyph).first->second;
+    }
+
+    uint32_t page {0};
+    drm::Rect area {};
+    if (!allocate(bitmap.width, bitmap.rows, page, area)) {
+        return nullptr;
+    }
+
+    auto& p {pages[page]};
+    for (uint32_t i {0}; i < bitmap.rows; i++) {
+        const auto src_row {bitmap.buffer + static_cast<ptrdiff_t>(i) * bitmap.pitch};
+        std::memcpy(p.pixels.get() + (area.y + i) * page_size + area.x, src_row, bitmap.width);
+    }
+
+    p.keys.push_back(key);
+    p.last_used = ++clock;
+
+    const Glyph glyph {page, area, slot->bitmap_left, slot->bitmap_top, static_cast<int32_t>(slot->advance.x >> 6)};
+    return &glyphs.insert_or_assign(key, glyph).first->second;
+}
+
+// Finds space for a w x h glyph, evicting the least recently used page if every page is full
+bool GlyphAtlas::allocate(const uint32_t w, const uint32_t h, uint32_t& page, drm::Rect& area) {
+    if (w > page_size || h > page_size) {
+        return false;
+    }
+
+    for (uint32_t i {0}; i < pages.size(); i++) {
+        if (allocate_in_page(pages[i], w, h, area)) {
+            page = i;
+            return true;
+        }
+    }
+
+    if (pages.size() < max_pages) {
+        pages.push_back(Page{std::make_unique<uint8_t[]>(page_size * page_size), {}, {}, 0});
+        page = pages.size() - 1;
+    } else {
+        const auto lru {std::min_element(pages.begin(), pages.end(), [](const auto& a, const auto& b) {
+            return a.last_used < b.last_used;
+        })};
+        page = lru - pages.begin();
+        evict(page);
+    }
+
+    return allocate_in_page(pages[page], w, h, area);
+}
+
+// Packs glyphs into horizontal shelves, reusing a shelf if the glyph is not much shorter than it
+bool GlyphAtlas::allocate_in_page(Page& page, const uint32_t w, const uint32_t h, drm::Rect& area) const noexcept {
+    // Leave a pixel of padding so that glyphs never bleed into each other
+    const uint32_t padded_w {w + 1};
+    const uint32_t padded_h {h + 1};
+
+    for (auto& shelf: page.shelves) {
+        if (shelf.height >= padded_h && shelf.height <= padded_h + padded_h/4 + 2 && shelf.x + padded_w <= page_size) {
+            area = drm::Rect{static_cast<int32_t>(shelf.x), static_cast<int32_t>(shelf.y), w, h};
+            shelf.x += padded_w;
+            return true;
+        }
+    }
+
+    const uint32_t next_y {page.shelves.empty() ? 0 : page.shelves.back().y + page.shelves.back().height};
+    if (next_y + padded_h > page_size) {
+        return false;
+    }
+
+    page.shelves.push_back(Shelf{next_y, padded_h, padded_w});
+    area = drm::Rect{0, static_cast<int32_t>(next_y), w, h};
+    return true;
+}
+
+void GlyphAtlas::evict(const uint32_t page) noexcept {
+    auto& p {pages[page]};
+    for (const auto& key: p.keys) {
+        glyphs.erase(key);
+    }
+    p.keys.clear();
+    p.shelves.clear();
+    std::fill_n(p.pixels.get(), page_size * page_size, 0);
+}
+
+}
@@ -0,0 +1,10 @@
+#include "text.h"
+
+namespace text {
+
+TextException::TextException(const std::string msg) noexcept : std::runtime_error(msg) {}
+
+TextException::TextException(const std::string msg, const FT_Error err) noexcept :
+        std::runtime_error(msg + ": FreeType error " + std::to_string(err)) {}
+
+}
@@ -0,0 +1,81 @@
+#include "text.h"
+
+namespace text {
+
+TextRenderer::TextRenderer(const Font& font, const uint32_t size, GlyphAtlas& atlas) noexcept :
+        font{font}, size{size}, atlas{atlas} {}
+
+// Decodes the next code point, advancing pos. Malformed sequences decode as U+FFFD
+static uint32_t next_codepoint(const std::string& s, size_t& pos) noexcept {
+    const auto byte = [&s](const size_t i) { return static_cast<uint8_t>(s[i]); };
+
+    const uint8_t lead {byte(pos++)};
+    uint32_t len {0};
+    uint32_t cp {0};
+    if (lead < 0x80) {
+        return lead;
+    } else if ((lead & 0xE0) == 0xC0) {
+        len = 1;
+        cp = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+        len = 2;
+        cp = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+        len = 3;
+        cp = lead & 0x07;
+    } else {
+        return 0xFFFD;
+    }
+
+    for (uint32_t i {0}; i < len; i++) {
+        if (pos >= s.size() || (byte(pos) & 0xC0) != 0x80) {
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (byte(pos++) & 0x3F);
+    }
+    return cp;
+}
+
+// Calls f(glyph, pen_x) for each glyph of the run, and returns the run's advance
+template <typename F>
+int32_t TextRenderer::layout(const std::string& utf8, const F& f) const {
+    int32_t pen_x {0};
+    uint32_t previous {0};
+    const bool kerning {font.set_size(size)}; // Once for the run; rasterising glyphs at the same size keeps it
+
+    size_t pos {0};
+    while (pos < utf8.size()) {
+        const auto glyph_index {font.get_glyph_index(next_codepoint(utf8, pos))};
+        if (kerning) {
+            pen_x += font.get_kerning(previous, glyph_index);
+        }
+        previous = glyph_index;
+
+        const auto glyph {atlas.get_glyph(font, size, glyph_index)};
+        if (!glyph) {
+            continue;
+        }
+        f(*glyph, pen_x);
+        pen_x += glyph->advance;
+    }
+    return pen_x;
+}
+
+// Draws text with its baseline starting at (x, baseline), returning the advance
+int32_t TextRenderer::draw(drm::Buffer& dst, const int32_t x, const int32_t baseline, const std::string& utf8,
+        const style::Colour c) const {
+    return layout(utf8, [&](const Glyph& glyph, const int32_t pen_x) {
+        if (glyph.area.is_empty()) {
+            return;
+        }
+        const auto mask {atlas.get_page_pixels(glyph.page) + glyph.area.y * GlyphAtlas::page_size + glyph.area.x};
+        dst.blend_mask(mask, GlyphAtlas::page_size, glyph.area.w, glyph.area.h,
+            x + pen_x + glyph.bearing_x, baseline - glyph.bearing_y, c);
+    });
+}
+
+int32_t TextRenderer::measure(const std::string& utf8) const {
+    return layout(utf8, [](const Glyph&, const int32_t) {});
+}
+
+}
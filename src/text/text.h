@@ -0,0 +1,115 @@
+#include "../drm/drm.h"
+#include "../style/style.h"
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#ifndef TEXT_H
+#define TEXT_H
+
+namespace text {
+
+class TextException : public std::runtime_error {
+public:
+    TextException(const std::string msg) noexcept;
+    TextException(const std::string msg, const FT_Error err) noexcept;
+};
+
+class Font {
+public:
+    Font(const std::string& path, const uint32_t face_index = 0);
+    Font(const Font&) = delete;
+    Font& operator=(const Font&) = delete;
+    ~Font();
+    uint32_t get_id() const noexcept { return id; };
+    FT_Face get_face() const noexcept { return face; };
+    uint32_t get_glyph_index(const uint32_t codepoint) const noexcept { return FT_Get_Char_Index(face, codepoint); };
+    bool set_size(const uint32_t size) const noexcept;
+    int32_t get_kerning(const uint32_t left, const uint32_t right) const noexcept;
+    uint32_t get_line_height(const uint32_t size) const noexcept;
+private:
+    static FT_Library get_library();
+    FT_Face load_face(const std::string& path, const uint32_t face_index) const;
+
+    const uint32_t id;
+    const FT_Face face;
+    mutable uint32_t current_size {0}; // The face's pixel size, 0 if not set
+};
+
+// Glyph describes where a rasterised glyph lives in a GlyphAtlas page, and how to place it
+struct Glyph {
+    uint32_t page;
+    drm::Rect area; // Within the page
+    int32_t bearing_x, bearing_y;
+    int32_t advance;
+};
+
+// GlyphAtlas rasterises each glyph once into shared A8 (coverage-only) pages. Memory is bounded: when the atlas is
+// full, the least recently used page is emptied and reused. Blank glyphs, which are only metrics, are all dropped
+// once there are too many of them
+class GlyphAtlas {
+public:
+    GlyphAtlas(const size_t max_bytes = 4 * page_size * page_size);
+    GlyphAtlas(const GlyphAtlas&) = delete;
+    GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+    static GlyphAtlas& the();
+    const Glyph* get_glyph(const Font& font, const uint32_t size, const uint32_t glyph_index);
+    const uint8_t* get_page_pixels(const uint32_t page) const noexcept { return pages[page].pixels.get(); };
+    static constexpr uint32_t page_size {1024};
+    static constexpr size_t max_blank_glyphs {1024};
+private:
+    using Key = std::tuple<uint32_t, uint32_t, uint32_t>; // Font ID, pixel size, glyph index
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const noexcept;
+    };
+
+    struct Shelf {
+        uint32_t y, height, x;
+    };
+
+    struct Page {
+        std::unique_ptr<uint8_t[]> pixels;
+        std::vector<Shelf> shelves;
+        std::vector<Key> keys;
+        uint64_t last_used;
+    };
+
+    const Glyph* rasterise(const Font& font, const uint32_t size, const uint32_t glyph_index);
+    bool allocate(const uint32_t w, const uint32_t h, uint32_t& page, drm::Rect& area);
+    bool allocate_in_page(Page& page, const uint32_t w, const uint32_t h, drm::Rect& area) const noexcept;
+    void evict(const uint32_t page) noexcept;
+
+    const size_t max_pages;
+    uint64_t clock {0};
+    std::vector<Page> pages {};
+    std::unordered_map<Key, Glyph, KeyHash> glyphs {};
+    std::vector<Key> blank_keys {}; // Glyphs which have no page to be evicted with
+};
+
+// TextRenderer draws runs of UTF-8 text into a buffer using glyphs from an atlas
+class TextRenderer {
+public:
+    TextRenderer(const Font& font, const uint32_t size, GlyphAtlas& atlas = GlyphAtlas::the()) noexcept;
+    TextRenderer(const TextRenderer&) = delete;
+    TextRenderer& operator=(const TextRenderer&) = delete;
+    int32_t draw(drm::Buffer& dst, const int32_t x, const int32_t baseline, const std::string& utf8, const style::Colour c) const;
+    int32_t measure(const std::string& utf8) const;
+private:
+    template <typename F>
+    int32_t layout(const std::string& utf8, const F& f) const;
+
+    const Font& font;
+    const uint32_t size;
+    GlyphAtlas& atlas;
+};
+
+}
+
+#endif
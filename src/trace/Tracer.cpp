@@ -0,0 +1,143 @@
+#include "trace.h"
+#include "../logging/logging.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace trace {
+
+// The count is advanced with a compare-exchange so that an event which was being recorded when the buffer was cleared
+// is dropped, rather than publishing the events from before the clear again
+void ThreadBuffer::record(const Event& event) noexcept {
+    auto i {count.load(std::memory_order_relaxed)};
+    if (i == events.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    events[i] = event;
+    count.compare_exchange_strong(i, i + 1, std::memory_order_release, std::memory_order_relaxed);
+}
+
+void ThreadBuffer::clear() noexcept {
+    count.store(0, std::memory_order_release);
+    dropped.store(0, std::memory_order_relaxed);
+}
+
+Tracer& Tracer::the() {
+    static Tracer instance {};
+    return instance;
+}
+
+uint64_t Tracer::now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Each thread's buffer is made on its first event. The list keeps buffers alive after their threads exit, so their
+// events can still be written out
+ThreadBuffer* Tracer::get_thread_buffer() noexcept {
+    thread_local std::shared_ptr<ThreadBuffer> buffer {};
+    if (!buffer) {
+        try {
+            buffer = std::make_shared<ThreadBuffer>(static_cast<uint32_t>(syscall(SYS_gettid)), capacity);
+            const std::lock_guard<std::mutex> lock {mutex};
+            buffers.push_back(buffer);
+        } catch (const std::exception&) {
+            buffer.reset();
+            return nullptr;
+        }
+    }
+    return buffer.get();
+}
+
+// Forgets every event recorded so far, so tracing can be started again with empty buffers. Call it while tracing is
+// stopped and nothing is being written out. Buffers of threads which have exited are freed
+void Tracer::clear() noexcept {
+    const std::lock_guard<std::mutex> lock {mutex};
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const auto& buffer) {
+        return buffer.use_count() == 1;
+    }), buffers.end());
+    for (const auto& buffer: buffers) {
+        buffer->clear();
+    }
+}
+
+void Tracer::record(const Event& event) noexcept {
+    const auto buffer {get_thread_buffer()};
+    if (buffer) {
+        buffer->record(event);
+    }
+}
+
+// Marks a moment, such as a vblank
+void Tracer::instant(const char* name) noexcept {
+    if (is_enabled()) {
+        record(Event{name, now(), -1});
+    }
+}
+
+static void write_string(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            out << '\\';
+        }
+        out << *s;
+    }
+    out << '"';
+}
+
+// Timestamps are in microseconds, with nanoseconds as the fraction. Events recorded while this runs may or may not be
+// included
+void Tracer::write(std::ostream& out) const {
+    const auto pid {getpid()};
+    char time[32];
+    const auto microseconds {[&time](const uint64_t ns) {
+        std::snprintf(time, sizeof(time), "%" PRIu64 ".%03" PRIu64, ns / 1000, ns % 1000);
+        return time;
+    }};
+
+    std::vector<std::shared_ptr<ThreadBuffer>> snapshot;
+    {
+        const std::lock_guard<std::mutex> lock {mutex};
+        snapshot = buffers;
+    }
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first {true};
+    for (const auto& buffer: snapshot) {
+        const auto n {buffer->get_count()};
+        for (size_t i {0}; i < n; i++) {
+            const auto& event {(*buffer)[i]};
+            out << (first ? "\n" : ",\n") << "{\"name\":";
+            write_string(out, event.name);
+            out << ",\"ts\":" << microseconds(event.start_ns);
+            if (event.duration_ns < 0) {
+                out << ",\"ph\":\"i\",\"s\":\"p\"";
+            } else {
+                out << ",\"ph\":\"X\",\"dur\":" << microseconds(event.duration_ns);
+            }
+            out << ",\"pid\":" << pid << ",\"tid\":" << buffer->get_tid() << "}";
+            first = false;
+        }
+        if (buffer->get_dropped()) {
+            LOG_WARNING("trace buffer for thread " << buffer->get_tid() << " overflowed: " << buffer->get_dropped()
+                << " events dropped");
+        }
+    }
+    out << "\n]}\n";
+}
+
+void Tracer::write(const std::string& path) const {
+    std::ofstream out {path};
+    if (!out) {
+        LOG_ERROR("failed to open trace file " << path);
+        return;
+    }
+    write(out);
+}
+
+}
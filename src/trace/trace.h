@@ -0,0 +1,100 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Trace points are compiled in only when DISPLAY_TRACE is defined, and otherwise cost nothing. When compiled in, they
+// cost a relaxed atomic load until tracing is started at runtime. Names must be string literals, as only the pointer is
+// kept
+#ifdef DISPLAY_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) const trace::Scope TRACE_CONCAT(trace_scope_, __LINE__) {name}
+#define TRACE_INSTANT(name) trace::Tracer::the().instant(name)
+#else
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#define TRACE_INSTANT(name) static_cast<void>(0)
+#endif
+
+namespace trace {
+
+struct Event {
+    const char* name;
+    uint64_t start_ns; // steady_clock, the same clock as page-flip timestamps
+    int64_t duration_ns; // Negative for instant events
+};
+
+// ThreadBuffer holds one thread's events. Only its thread writes to it, publishing each event by advancing the count
+// with a release compare-exchange, so recording takes no locks. When the buffer is full, further events are counted
+// and dropped rather than overwriting ones which may be being read, until the buffer is cleared
+class ThreadBuffer {
+public:
+    ThreadBuffer(const uint32_t tid, const size_t capacity) : tid{tid}, events(capacity) {};
+    ThreadBuffer(const ThreadBuffer&) = delete;
+    ThreadBuffer& operator=(const ThreadBuffer&) = delete;
+    void record(const Event& event) noexcept;
+    void clear() noexcept;
+    uint32_t get_tid() const noexcept { return tid; };
+    size_t get_count() const noexcept { return count.load(std::memory_order_acquire); };
+    const Event& operator[](const size_t i) const noexcept { return events[i]; };
+    uint64_t get_dropped() const noexcept { return dropped.load(std::memory_order_relaxed); };
+private:
+    const uint32_t tid;
+    std::vector<Event> events;
+    std::atomic<size_t> count {0};
+    std::atomic<uint64_t> dropped {0};
+};
+
+// Tracer collects events from every thread and writes them as Chrome trace-event JSON, which chrome://tracing and
+// ui.perfetto.dev both open
+class Tracer {
+public:
+    Tracer() noexcept {};
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    static Tracer& the();
+    void start() noexcept { enabled.store(true, std::memory_order_relaxed); };
+    void stop() noexcept { enabled.store(false, std::memory_order_relaxed); };
+    bool is_enabled() const noexcept { return enabled.load(std::memory_order_relaxed); };
+    void set_capacity(const size_t events_per_thread) noexcept { capacity = events_per_thread; };
+    void clear() noexcept;
+    void record(const Event& event) noexcept;
+    void instant(const char* name) noexcept;
+    void write(std::ostream& out) const;
+    void write(const std::string& path) const;
+    static uint64_t now() noexcept;
+private:
+    ThreadBuffer* get_thread_buffer() noexcept;
+
+    std::atomic<bool> enabled {false};
+    size_t capacity {1 << 16}; // Events kept per thread. Changing it only affects threads which haven't recorded yet
+    mutable std::mutex mutex {}; // Guards the list of buffers, not their contents
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers {};
+};
+
+// Scope records a complete event covering its lifetime, if tracing was enabled when it began
+class Scope {
+public:
+    Scope(const char* name) noexcept : name{name}, start{Tracer::the().is_enabled() ? Tracer::now() : 0} {};
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() {
+        if (start) {
+            Tracer::the().record(Event{name, start, static_cast<int64_t>(Tracer::now() - start)});
+        }
+    };
+private:
+    const char* const name;
+    const uint64_t start;
+};
+
+}
+
+#endif